@@ -21,9 +21,11 @@
  * You can verify this for yourself using gcc -v.
  *******************************************************/
 
-#if defined(__i386__)  
+#if defined(__i386__) || defined(__x86_64__)
 /*******************************************************
  * Pentium versions of start_counter() and get_counter()
+ * (rdtsc behaves the same in 64-bit mode: the counter is
+ * returned in edx:eax with the upper halves of rdx/rax cleared)
  *******************************************************/
 
 
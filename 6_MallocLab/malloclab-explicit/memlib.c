@@ -3,6 +3,7 @@
  *            allows us to interleave calls from the student's malloc package 
  *            with the system's malloc package in libc.
  */
+#define _GNU_SOURCE /* mremap */
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
@@ -18,20 +19,51 @@
 static char *mem_start_brk;  /* points to first byte of heap */
 static char *mem_brk;        /* points to last byte of heap */
 static char *mem_max_addr;   /* largest legal heap address */ 
+static char *mem_peak_brk;   /* highest brk since the last reset */
+static size_t mem_sbrks;     /* mem_sbrk calls since the last reset */
+static size_t mem_max_heap = MAX_HEAP; /* size of the modelled VM */
+
+/* regions mapped with mem_map, outside the heap */
+typedef struct mem_region {
+    char *start;
+    size_t len;
+    struct mem_region *next;
+} mem_region_t;
+static mem_region_t *mem_regions;
+static size_t mem_mapped;         /* bytes in mapped regions */
+static size_t mem_peak_total;   /* largest heap + mapped since reset */
+
+static void mem_drop_pages(char *lo, char *hi);
+static mem_region_t **mem_find_region(char *start);
+static void mem_update_peak(void);
+
+/*
+ * mem_set_max_heap - set the size of the VM that mem_init models.
+ *    Must be called before mem_init.
+ */
+void mem_set_max_heap(size_t size)
+{
+    mem_max_heap = size;
+}
 
 /* 
  * mem_init - initialize the memory system model
  */
 void mem_init(void)
 {
-    /* allocate the storage we will use to model the available VM */
-    if ((mem_start_brk = (char *)malloc(MAX_HEAP)) == NULL) {
-	fprintf(stderr, "mem_init_vm: malloc error\n");
+    /* map the storage we will use to model the available VM; pages are
+       only backed once the heap grows into them, so it may be large */
+    mem_start_brk = (char *)mmap(NULL, mem_max_heap, PROT_READ | PROT_WRITE,
+				 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+				 -1, 0);
+    if (mem_start_brk == MAP_FAILED) {
+	fprintf(stderr, "mem_init_vm: mmap error\n");
 	exit(1);
     }
 
-    mem_max_addr = mem_start_brk + MAX_HEAP;  /* max legal heap address */
+    mem_max_addr = mem_start_brk + mem_max_heap;  /* max legal heap address */
     mem_brk = mem_start_brk;                  /* heap is empty initially */
+    mem_peak_brk = mem_start_brk;
 }
 
 /* 
@@ -39,35 +71,173 @@ void mem_init(void)
  */
 void mem_deinit(void)
 {
-    free(mem_start_brk);
+    mem_reset_brk();
+    munmap(mem_start_brk, mem_max_heap);
 }
 
 /*
- * mem_reset_brk - reset the simulated brk pointer to make an empty heap
+ * mem_reset_brk - reset the simulated brk pointer to make an empty heap,
+ *    and unmap every region left over from mem_map
  */
 void mem_reset_brk()
 {
+    while (mem_regions)
+	mem_unmap(mem_regions->start);
     mem_brk = mem_start_brk;
+    mem_peak_brk = mem_start_brk;
+    mem_peak_total = 0;
+    mem_sbrks = 0;
 }
 
 /* 
  * mem_sbrk - simple model of the sbrk function. Extends the heap 
- *    by incr bytes and returns the start address of the new area. In
- *    this model, the heap cannot be shrunk.
+ *    by incr bytes and returns the start address of the new area. A
+ *    negative incr shrinks the heap, and the whole pages above the new
+ *    brk are given back to the system.
  */
 void *mem_sbrk(int incr) 
 {
     char *old_brk = mem_brk;
 
-    if ( (incr < 0) || ((mem_brk + incr) > mem_max_addr)) {
+    mem_sbrks++;
+    if ( (mem_brk + incr < mem_start_brk) || ((mem_brk + incr) > mem_max_addr)) {
 	errno = ENOMEM;
 	fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
 	return (void *)-1;
     }
     mem_brk += incr;
+    if (incr < 0)
+	mem_drop_pages(mem_brk, old_brk);
+    if (mem_brk > mem_peak_brk)
+	mem_peak_brk = mem_brk;
+    mem_update_peak();
     return (void *)old_brk;
 }
 
+/*
+ * mem_map - map a region of len bytes (a multiple of the page size)
+ *    outside the heap. Returns its start, or (void *)-1 on failure.
+ */
+void *mem_map(size_t len)
+{
+    mem_region_t *r;
+    char *start;
+
+    start = mmap(NULL, len, PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (start == MAP_FAILED)
+	return (void *)-1;
+    if ((r = malloc(sizeof(mem_region_t))) == NULL) {
+	munmap(start, len);
+	return (void *)-1;
+    }
+    r->start = start;
+    r->len = len;
+    r->next = mem_regions;
+    mem_regions = r;
+
+    mem_mapped += len;
+    mem_update_peak();
+    return start;
+}
+
+/*
+ * mem_remap - resize the region at start to len bytes, moving it if
+ *    need be. Returns its new start, or (void *)-1 on failure.
+ */
+void *mem_remap(void *start, size_t len)
+{
+    mem_region_t *r = *mem_find_region(start);
+    char *newstart;
+
+    newstart = mremap(r->start, r->len, len, MREMAP_MAYMOVE);
+    if (newstart == MAP_FAILED)
+	return (void *)-1;
+    mem_mapped += len - r->len;
+    r->start = newstart;
+    r->len = len;
+    mem_update_peak();
+    return newstart;
+}
+
+/*
+ * mem_unmap - unmap the region at start
+ */
+void mem_unmap(void *start)
+{
+    mem_region_t **rp = mem_find_region(start);
+    mem_region_t *r = *rp;
+
+    munmap(r->start, r->len);
+    mem_mapped -= r->len;
+    *rp = r->next;
+    free(r);
+}
+
+/*
+ * mem_contains - is [lo, hi] inside the heap or inside one mapped region?
+ */
+int mem_contains(void *lo, void *hi)
+{
+    mem_region_t *r;
+
+    if ((char *)lo >= mem_start_brk && (char *)hi < mem_brk)
+	return 1;
+    for (r = mem_regions; r != NULL; r = r->next)
+	if ((char *)lo >= r->start && (char *)hi < r->start + r->len)
+	    return 1;
+    return 0;
+}
+
+/*
+ * mem_find_region - the link that points to the region at start
+ */
+static mem_region_t **mem_find_region(char *start)
+{
+    mem_region_t **rp;
+
+    for (rp = &mem_regions; *rp != NULL; rp = &(*rp)->next)
+	if ((*rp)->start == start)
+	    return rp;
+    fprintf(stderr, "ERROR: %p is not a mapped region\n", start);
+    exit(1);
+}
+
+/*
+ * mem_update_peak - record a new high of heap plus mapped bytes
+ */
+static void mem_update_peak(void)
+{
+    size_t footprint = mem_heapsize() + mem_mapped;
+
+    if (footprint > mem_peak_total)
+	mem_peak_total = footprint;
+}
+
+/*
+ * mem_release - give the whole pages in [addr, addr+len) back to the
+ *    system. The range stays part of the heap; its pages read as zero
+ *    when next touched.
+ */
+void mem_release(void *addr, size_t len)
+{
+    mem_drop_pages((char *)addr, (char *)addr + len);
+}
+
+/*
+ * mem_drop_pages - madvise away the whole pages in [lo, hi)
+ */
+static void mem_drop_pages(char *lo, char *hi)
+{
+    size_t pagesize = mem_pagesize();
+    char *start = mem_start_brk + 
+	(lo - mem_start_brk + pagesize - 1) / pagesize * pagesize;
+    char *end = mem_start_brk + (hi - mem_start_brk) / pagesize * pagesize;
+
+    if (start < end)
+	madvise(start, end - start, MADV_DONTNEED);
+}
+
 /*
  * mem_heap_lo - return address of the first heap byte
  */
@@ -92,6 +262,62 @@ size_t mem_heapsize()
     return (size_t)(mem_brk - mem_start_brk);
 }
 
+/*
+ * mem_peak_heapsize() - returns the largest heap size since the last reset
+ */
+size_t mem_peak_heapsize()
+{
+    return (size_t)(mem_peak_brk - mem_start_brk);
+}
+
+/*
+ * mem_sbrk_calls() - returns the number of mem_sbrk calls since the last
+ *    reset, failed ones included
+ */
+size_t mem_sbrk_calls()
+{
+    return mem_sbrks;
+}
+
+/*
+ * mem_mapsize() - returns the bytes in regions mapped with mem_map
+ */
+size_t mem_mapsize()
+{
+    return mem_mapped;
+}
+
+/*
+ * mem_peak_footprint() - returns the largest heap size plus mapped bytes
+ *    since the last reset
+ */
+size_t mem_peak_footprint()
+{
+    return mem_peak_total;
+}
+
+/*
+ * mem_resident() - returns the bytes of the heap that are backed by
+ *    physical pages
+ */
+size_t mem_resident()
+{
+    size_t pagesize = mem_pagesize();
+    size_t i, npages = (mem_heapsize() + pagesize - 1) / pagesize;
+    size_t resident = 0;
+    unsigned char *vec;
+
+    if (npages == 0)
+	return 0;
+    if ((vec = malloc(npages)) == NULL)
+	return 0;
+    if (mincore(mem_start_brk, npages * pagesize, vec) == 0)
+	for (i = 0; i < npages; i++)
+	    resident += (vec[i] & 1) * pagesize;
+    free(vec);
+    return resident;
+}
+
 /*
  * mem_pagesize() - returns the page size of the system
  */
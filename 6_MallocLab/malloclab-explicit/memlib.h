@@ -1,11 +1,22 @@
 #include <unistd.h>
 
+void mem_set_max_heap(size_t size);
 void mem_init(void);               
 void mem_deinit(void);
 void *mem_sbrk(int incr);
+void mem_release(void *addr, size_t len);
+void *mem_map(size_t len);
+void *mem_remap(void *start, size_t len);
+void mem_unmap(void *start);
+int mem_contains(void *lo, void *hi);
 void mem_reset_brk(void); 
 void *mem_heap_lo(void);
 void *mem_heap_hi(void);
 size_t mem_heapsize(void);
+size_t mem_peak_heapsize(void);
+size_t mem_sbrk_calls(void);
+size_t mem_mapsize(void);
+size_t mem_peak_footprint(void);
+size_t mem_resident(void);
 size_t mem_pagesize(void);
 
@@ -1,18 +1,113 @@
 /*
  * mm-explicit.c
- * 
- * Explicit free list, with FIFO. Support first-fit and best-fit.
- * 
- * Scheme: 
+ *
+ * Segregated explicit free lists, LIFO or address-ordered within each
+ * list. Support first-fit, and best-fit through a splay tree per large
+ * size class. The policies are build-time settings (see FIT below).
+ *
+ * Scheme:
  * "predecessor" and "successor" are in terms of heap.
  * "previous" and "next" are in terms of free list.
- * 
- * From the lecture slide, "next" and "prev" points to the 
- * header of the next/previous free block.
- * 
- * Performance: 
- * first-fit:
- * 
+ *
+ * From the lecture slide, "next" and "prev" points to the
+ * next/previous free block. Here they hold its offset from the start
+ * of the heap (see LINK), so they stay 32 bits on a 64-bit host.
+ *
+ * Block layout:
+ * Allocated: [header | payload ...]
+ * Free:      [header | next | prev | ... | footer]
+ * Only free blocks have a footer. Each header also records whether the
+ * block's predecessor is allocated (PREV_ALLOC), which is all coalesce()
+ * needs to know about an allocated predecessor; a free one is found
+ * through its footer as usual. Allocated blocks cost one word of overhead
+ * and the minimum block is 16 bytes (header, two links, footer; 24 bytes
+ * with 64-bit links).
+ *
+ * Size classes:
+ * Free blocks are kept in NUM_CLASSES lists by size. Small blocks get one
+ * class per multiple of 8 bytes (16, 24, ..., 64), larger blocks one class
+ * per power of two ((64, 128], (128, 256], ...), and the last class holds
+ * everything bigger. The list heads live in the first NUM_CLASSES words of
+ * the heap (the lab forbids global arrays). A request only scans its own
+ * class; any block at the head of a higher class is guaranteed to fit.
+ * One bit per class in class_map says whether the class is non-empty, so
+ * the first non-empty higher class is found with a count-trailing-zeros
+ * instead of a walk over the heads, and size_class is a count-leading-
+ * zeros instead of a loop (the first level of TLSF; the second level is
+ * the list or tree of the class).
+ *
+ * Best-fit trees:
+ * With BEST_FIT, the classes above SMALL_LIMIT are splay trees keyed by
+ * block size rather than lists, with equal-sized blocks chained to one
+ * tree node. The small classes hold a single size each, so their head is
+ * already the best fit. Finding, inserting and removing a block is
+ * O(log n) amortized however many distinct sizes a class holds, so exact
+ * best-fit no longer costs a scan. The child links follow next/prev in
+ * the free payload, which is at least 64 bytes in a tree class.
+ *
+ * Realloc:
+ * mm_realloc shrinks and grows blocks in place where it can (see the
+ * comment on mm_realloc), and a block that keeps growing reserves 50%
+ * slack, so a run of growing reallocs is mostly served without a copy.
+ *
+ * Slabs:
+ * With SLAB, requests of up to 128 bytes skip the boundary-tag heap and
+ * come from 4 KB slabs of equal-sized objects, one class per multiple of
+ * 8. An object has no header: its slab is found by rounding its address
+ * down to a slab boundary, and a bitmap in the slab header records which
+ * objects are free. A slab is itself an allocated block of the heap, and
+ * a bitmap with one bit per heap page tells mm_free whether a pointer is
+ * a slab object or an ordinary block. An empty slab is given back to the
+ * heap unless it is the last one of its class with room. An 8-byte
+ * request no longer takes a 16-byte block, but tiny heaps pay for a
+ * whole slab page.
+ *
+ * Trimming:
+ * With TRIM_THRESHOLD and RELEASE_THRESHOLD set (both are off by default),
+ * mm_free gives memory back once a free block is large: a free block of
+ * TRIM_THRESHOLD bytes or more at the end of the heap is cut back to
+ * TRIM_PAD bytes with a negative mem_sbrk, and the pages inside any other
+ * free block of RELEASE_THRESHOLD bytes or more are released with
+ * mem_release (madvise); mdriver -v prints the peak and final resident
+ * heap. The page map and retained empty slabs often sit near the top of
+ * the heap, so the final brk stays higher than the resident size. The
+ * driver rebuilds each heap from zero on every timed run, so released
+ * pages fault in again and cost throughput; "make sweep" compares.
+ *
+ * Heap growth:
+ * A request that finds no fit grows the heap by its exact shortfall,
+ * less any free block at the end of the heap, unless the heap grew in the
+ * last 64 requests: then the step doubles from CHUNKSIZE up to 16 KB
+ * (grow_size). This makes far fewer mem_sbrk calls than always growing
+ * by max(request, CHUNKSIZE) without wasting more of the heap; mdriver -v
+ * counts them.
+ *
+ * Large blocks:
+ * With MMAP_THRESHOLD set (it is off by default), requests of that many
+ * bytes or more never touch the heap. Each one gets its own
+ * region from mem_map (mmap), which mm_free unmaps at once, so a large
+ * block never strands a hole in the heap. mm_realloc resizes these
+ * blocks with mem_remap (mremap), which moves pages without copying the
+ * data. A heap block that grows past the threshold is copied into a
+ * region once. Utilization counts the peak footprint, heap plus
+ * mappings. Every large request costs system calls, which is why this is
+ * opt-in; "make sweep" compares.
+ *
+ * Deferred coalescing:
+ * With DEFER_COALESCE, mm_free puts a heap block of up to 512 bytes on a
+ * quick list of its size instead of coalescing it, and mm_malloc hands
+ * it straight back to the next request of that size. The quick lists are
+ * coalesced in bulk after 256 such frees, or before the heap would grow
+ * for want of a fit, so utilization barely moves. It pays off most on
+ * traces that keep freeing and reallocating mid-sized blocks among many
+ * live ones.
+ *
+ * Performance:
+ * The numbers below are for the original single free list, measured on
+ * a 32-bit VM. "make sweep" measures the current policies.
+ *
+ * single list, first-fit:
+ *
  * Team Name:FastLearn
     Member 1 :Fred Yue YIN:yy0125@connect.hku.hk
     Using default tracefiles in ./traces/
@@ -34,9 +129,9 @@
     Total         75%  112372  0.162962   690
 
     Perf index = 45 (util) + 40 (thru) = 85/100
- * 
- * best-fit:
- * 
+ *
+ * single list, best-fit:
+ *
     Team Name:FastLearn
     Member 1 :Fred Yue YIN:yy0125@connect.hku.hk
     Using default tracefiles in ./traces/
@@ -60,6 +155,7 @@
     Perf index = 46 (util) + 29 (thru) = 75/100
  */
 #include <assert.h>
+#include <limits.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -86,8 +182,42 @@ team_t team = {
 
 
 
+/*
+ * Build-time policy. Each setting can also be given on the compiler
+ * command line (-DFIT=0 -DADDR_ORDER=1 -DCHUNKSIZE=4096); "make sweep"
+ * builds and runs every combination listed in the Makefile.
+ *   FIT         0: first fit, 1: best fit (2, next fit, is implicit only)
+ *   ADDR_ORDER  0: LIFO free lists, 1: free lists in address order
+ *   CHUNKSIZE   first step of the heap's growth in a burst (see grow_size)
+ *   GROW_WINDOW, GROW_MAX  when and how far a burst grows (below)
+ *   DEFER_COALESCE  0: coalesce on every free, 1: quick lists (below)
+ *   SLAB        0: every request from the heap, 1: slabs for small ones
+ *   LINK64      0: 32-bit offset links, 1: 64-bit pointer links
+ *   TRIM_THRESHOLD, RELEASE_THRESHOLD  0: keep freed memory (below)
+ *   MMAP_THRESHOLD  0: every request from the heap, else mappings (below)
+ * Address order applies to the lists; best-fit trees are ordered by size.
+ */
 // #define DEBUG_MODE
+#ifndef FIT
+#define FIT 1
+#endif
+#if FIT == 1
 #define BEST_FIT
+#elif FIT != 0
+#error "FIT must be 0 (first fit) or 1 (best fit)"
+#endif
+#ifndef ADDR_ORDER
+#define ADDR_ORDER 0
+#endif
+#ifndef DEFER_COALESCE
+#define DEFER_COALESCE 0
+#endif
+#ifndef SLAB
+#define SLAB 1
+#endif
+#ifndef LINK64
+#define LINK64 0
+#endif
 
 #ifdef DEBUG_MODE
     #define mm_checkheap(verbose) checkheap(verbose)
@@ -97,13 +227,107 @@ team_t team = {
 
 #define WSIZE 4
 #define DSIZE 8
-#define QSIZE 16
-#define MIN_BLOCKSIZE 24
+#ifndef CHUNKSIZE
 #define CHUNKSIZE (1 << 9)
+#endif
+
+/* The heap grows by the exact shortfall of a request, unless it last grew
+ * at most GROW_WINDOW heap requests ago: then by CHUNKSIZE, doubling on
+ * each such extension up to GROW_MAX bytes. */
+#ifndef GROW_WINDOW
+#define GROW_WINDOW 64
+#endif
+#ifndef GROW_MAX
+#define GROW_MAX (1 << 14)
+#endif
+
+/* A free block at the end of the heap of at least TRIM_THRESHOLD bytes is
+ * cut back to TRIM_PAD bytes by shrinking the heap. The pages inside a
+ * free block of at least RELEASE_THRESHOLD bytes elsewhere are given back
+ * to the system. A threshold of 0 turns that off, which is the default:
+ * the pages fault in again when the heap regrows, which costs throughput
+ * on traces that keep reusing the heap. Try -DTRIM_THRESHOLD=131072
+ * -DRELEASE_THRESHOLD=65536 for a heap that shrinks. */
+#ifndef TRIM_THRESHOLD
+#define TRIM_THRESHOLD 0
+#endif
+#ifndef TRIM_PAD
+#define TRIM_PAD (1 << 16)
+#endif
+#ifndef RELEASE_THRESHOLD
+#define RELEASE_THRESHOLD 0
+#endif
+#if TRIM_THRESHOLD && TRIM_THRESHOLD <= TRIM_PAD
+#error "TRIM_THRESHOLD must be larger than TRIM_PAD"
+#endif
+
+/* Requests of at least MMAP_THRESHOLD bytes get a region of their own from
+ * mem_map instead of a heap block; 0, the default, keeps every request in
+ * the heap. Try -DMMAP_THRESHOLD=131072. The region starts with its
+ * length, and the block header before the payload has size 0, which no
+ * heap block has. */
+#ifndef MMAP_THRESHOLD
+#define MMAP_THRESHOLD 0
+#endif
+#define MMAP_HDRSIZE (2 * DSIZE)
+#define IS_MAPPED(bp) (GET_SIZE(HDRP(bp)) == 0)
+#define MAP_BASE(bp) ((char *)(bp) - MMAP_HDRSIZE)
+#define MAP_LEN(bp) (*(size_t *)MAP_BASE(bp))
+
+/*
+ * Free-list links. By default a link is a block's offset from the start
+ * of the heap in double words, stored in 32 bits: that reaches 32 GB of
+ * heap wherever the heap is mapped, while keeping the minimum block at 16
+ * bytes. LINK64=1 stores plain 64-bit pointers instead, at the
+ * cost of a 24-byte minimum block.
+ */
+#if LINK64
+typedef uintptr_t link_t;
+#else
+typedef unsigned int link_t;
+#endif
+#define LSIZE ((int)sizeof(link_t))
+
+/* A free block holds a header, a footer and two links */
+#define MIN_BLOCKSIZE ((2 * WSIZE + 2 * LSIZE + DSIZE - 1) / DSIZE * DSIZE)
+
+/* Segregated free lists: classes of multiples of 8 up to 64 bytes, then
+ * one class per power of two. NUM_HEADS must be even to keep the heap
+ * double-word aligned after the list heads, and NUM_CLASSES at most 32
+ * for class_map. */
+#define NUM_CLASSES 20
+#define SMALL_LIMIT 64
+
+/* With SLAB, requests of up to SLAB_LIMIT bytes are served from
+ * SLAB_SIZE-byte slabs, one class per multiple of 8. The slab list heads,
+ * the page map and its size follow the free list heads. */
+#define SLAB_SIZE 4096
+#define SLAB_LIMIT 128
+#define SLAB_CLASSES (SLAB_LIMIT / DSIZE)
+#if SLAB
+#define SLAB_HEADS (SLAB_CLASSES + 2)
+#else
+#define SLAB_HEADS 0
+#endif
+
+/* With DEFER_COALESCE, a freed heap block of up to QUICK_LIMIT bytes goes
+ * on a quick list of its size (one per multiple of 8) and stays marked
+ * allocated, so nothing coalesces with it. The quick lists are freed for
+ * real once QUICK_MAX blocks wait on them, or when a request finds no
+ * fit. Their heads follow the slab heads. */
+#define QUICK_LIMIT 512
+#define QUICK_CLASSES (QUICK_LIMIT / DSIZE)
+#define QUICK_MAX 256
+#if DEFER_COALESCE
+#define QUICK_HEADS QUICK_CLASSES
+#else
+#define QUICK_HEADS 0
+#endif
 
-#define MAX_INT ((unsigned)((-1) << 1)) >> 1
+#define NUM_HEADS (NUM_CLASSES + SLAB_HEADS + QUICK_HEADS)
 
 #define MAX(x, y) ((x) > (y) ? (x) : (y))
+#define MIN(x, y) ((x) < (y) ? (x) : (y))
 
 /* Pack a size and allocated bit into a word */
 #define PACK(size, alloc) ((size) | (alloc))
@@ -112,78 +336,204 @@ team_t team = {
 #define GET(p) (*(unsigned int *)(p))
 #define PUT(p, val) (*(unsigned int *)(p) = (val))
 
+/* Read and write a free-list link at address p */
+#define GETL(p) (*(link_t *)(p))
+#define PUTL(p, val) (*(link_t *)(p) = (val))
+
 /* Read the size or allocated fields from (a header/footer) at address p */
 #define GET_SIZE(p) (GET(p) & ~0x7)
 #define GET_ALLOC(p) (GET(p) & 0x1)
 
-/* Given block ptr bp, compute address of header, footer, prev pointer and 
- * next pointer.
+/* Set in a header when the block before it on the heap is allocated */
+#define PREV_ALLOC 0x2
+#define GET_PREV_ALLOC(p) (GET(p) & PREV_ALLOC)
+#define SET_PREV_ALLOC(p) PUT(p, GET(p) | PREV_ALLOC)
+#define CLR_PREV_ALLOC(p) PUT(p, GET(p) & ~PREV_ALLOC)
+
+/* Set in the header of an allocated block that mm_realloc has grown
+ * before. Growing it again reserves slack, on the guess that it will keep
+ * growing. */
+#define REALLOC_TAG 0x4
+#define GET_TAG(p) (GET(p) & REALLOC_TAG)
+
+/* Given block ptr bp, compute address of header, footer, prev pointer and
+ * next pointer. Only free blocks have a footer and links.
  */
-#define HDRP(bp) ((char *)(bp)-3 * WSIZE)
-#define NEXTP(bp) ((char *)(bp)-2 * WSIZE)
-#define PREVP(bp) ((char *)(bp)-1 * WSIZE)
-#define FTRP(bp) ((char *)(bp) + GET_SIZE(HDRP(bp)) - QSIZE)
+#define HDRP(bp) ((char *)(bp)-WSIZE)
+#define NEXTP(bp) ((char *)(bp))
+#define PREVP(bp) ((char *)(bp) + LSIZE)
+#define FTRP(bp) ((char *)(bp) + GET_SIZE(HDRP(bp)) - DSIZE)
 
 /* Given block ptr bp, return the prev and next pointer themselves.
  */
-#define NEXTV(bp) (GET(NEXTP(bp)))
-#define PREVV(bp) (GET(PREVP(bp)))
+#define NEXTV(bp) (GETL(NEXTP(bp)))
+#define PREVV(bp) (GETL(PREVP(bp)))
+
+/* Given block ptr bp, compute the block pointer to the predecessor
+ * and successor in the heaplist. PRED_BLKP needs the predecessor's
+ * footer, so it only works if the predecessor is free.
+ */
+#define PRED_BLKP(bp) ((char *)(bp) - GET_SIZE(((char *)(bp)-DSIZE)))
+#define SUCC_BLKP(bp) ((char *)(bp) + GET_SIZE(((char *)(bp)-WSIZE)))
+
+/* Encode a block pointer as a list link and back. A link of 0 is NULL and
+ * terminates a list (no block starts at the bottom of the heap, where the
+ * list heads are).
+ */
+#if LINK64
+#define LINK(bp) ((link_t)(bp))
+#define UNLINK(v) ((char *)(v))
+#else
+#define LINK(bp) ((bp) ? (link_t)(((char *)(bp) - seg_listp) / DSIZE) : 0)
+#define UNLINK(v) ((v) ? seg_listp + (size_t)(v) * DSIZE : NULL)
+#endif
 
-/* Given block ptr bp, compute the block pointer to the predecessor 
- * and successor in the heaplist.
+/* Given block ptr bp of a free block, compute the block pointer to
+ * the previous and next free block (NULL at either end of a list).
  */
-#define PRED_BLKP(bp) ((char *)(bp) - GET_SIZE(((char *)(bp)-4 * WSIZE)))
-#define SUCC_BLKP(bp) ((char *)(bp) + GET_SIZE(((char *)(bp)-3 * WSIZE)))
+#define NEXT_BLKP(bp) UNLINK(NEXTV(bp))
+#define PREV_BLKP(bp) UNLINK(PREVV(bp))
+
+/* The head of size class i */
+#define HEADP(i) (seg_listp + (i) * LSIZE)
+#define HEAD_BLKP(i) UNLINK(GETL(HEADP(i)))
 
-/* Given block ptr bp of a free block, compute the block pointer to 
- * the previous and next free block.
+#if SLAB
+/*
+ * A slab is an allocated block whose payload starts on a SLAB_SIZE
+ * boundary (counted from the start of the heap), so the slab of an object
+ * is found by rounding its address down. It starts with a header:
+ * [next | prev | object size | free count | free bitmap], and the objects
+ * follow without headers of their own. Slabs with free objects are kept
+ * on a list per class, and a bit per heap page (the page map) records
+ * which pages are slabs.
  */
-#define NEXT_HDRP(bp) (GET(NEXTP(bp)))
-#define PREV_HDRP(bp) (GET(PREVP(bp)))
+#define SLAB_HEADP(c) HEADP(NUM_CLASSES + (c))
+#define SLAB_MAPP HEADP(NUM_CLASSES + SLAB_CLASSES)     /* Page map */
+#define SLAB_PAGESP HEADP(NUM_CLASSES + SLAB_CLASSES + 1) /* Pages it covers */
+
+#define SLAB_BASE(bp) \
+    (seg_listp + (((char *)(bp) - seg_listp) & ~(SLAB_SIZE - 1)))
+#define SLAB_ALIGN(bp) SLAB_BASE((char *)(bp) + SLAB_SIZE - 1)
+#define SLAB_PAGE(bp) (((char *)(bp) - seg_listp) / SLAB_SIZE)
+
+#define SLAB_NEXTP(s) ((char *)(s))
+#define SLAB_PREVP(s) ((char *)(s) + LSIZE)
+#define SLAB_OBJSIZEP(s) ((char *)(s) + 2 * LSIZE)
+#define SLAB_NFREEP(s) ((char *)(s) + 2 * LSIZE + WSIZE)
+#define SLAB_BITSP(s) ((char *)(s) + 2 * LSIZE + 2 * WSIZE)
+#define SLAB_BITWORDS 16
+#define SLAB_HDRSIZE (2 * LSIZE + 2 * WSIZE + SLAB_BITWORDS * WSIZE)
+
+/* Objects of the given size in a slab. The slab block ends one word
+ * before the next boundary, where the following block's header is. */
+#define SLAB_OBJS(size) ((SLAB_SIZE - WSIZE - SLAB_HDRSIZE) / (size))
+#endif
+
+/* The quick list of blocks of the given size */
+#define QUICK_HEADP(size) HEADP(NUM_CLASSES + SLAB_HEADS + (size) / DSIZE - 1)
 
-#define NEXT_BLKP(bp) ((char *)NEXT_HDRP(bp) + 3 * WSIZE)
-#define PREV_BLKP(bp) ((char *)PREV_HDRP(bp) + 3 * WSIZE)
+/* With BEST_FIT, each class from TREE_CLASS up is a splay tree keyed by
+ * block size instead of a list. A tree node keeps its child links in the
+ * two payload words after next/prev, and blocks of the same size hang off the node
+ * on a chain through next/prev. The node itself has prev == NULL, chained
+ * blocks never do.
+ */
+#define TREE_CLASS ((SMALL_LIMIT - MIN_BLOCKSIZE) / DSIZE + 1)
+#define LEFTP(bp) ((char *)(bp) + 2 * LSIZE)
+#define RIGHTP(bp) ((char *)(bp) + 3 * LSIZE)
+#define LEFT_BLKP(bp) UNLINK(GETL(LEFTP(bp)))
+#define RIGHT_BLKP(bp) UNLINK(GETL(RIGHTP(bp)))
 
 /**
- * Two list exists in our system. 
- * Heap list: a list consisting of all blocks. 
- * Free list: a list consisting purely free blocks. 
- * 
- * 
+ * Two kinds of list exist in our system.
+ * Heap list: a list consisting of all blocks.
+ * Free lists: NUM_CLASSES lists consisting purely of free blocks, whose
+ * heads are stored at seg_listp.
  */
 static char *heap_listp = 0; /* A block pointer pointing to the first block on the heap  */
-static char *free_listp = 0; /* A block pointer pointing to the first free block in the free list */
+static char *seg_listp = 0;  /* Array of NUM_CLASSES list heads at the start of the heap */
+static unsigned int class_map; /* Bit i set if size class i is non-empty */
+static int quick_count;        /* Blocks on the quick lists */
+static size_t growth;          /* Current growth step, 0 if not in a burst */
+static unsigned long requests; /* Heap requests (block_malloc calls) ... */
+static unsigned long grown_at; /* ... and their number at the last growth */
 
 /* Function prototypes for internal helper routines */
 static void *extend_heap(size_t words);
+static size_t grow_size(size_t asize);
 static void place(void *bp, size_t asize);
 static void *find_fit(size_t asize);
+static void *class_fit(size_t asize);
 static void *coalesce(void *bp);
+static size_t adjust_size(size_t size);
+static void realloc_place(void *bp, size_t csize, size_t asize);
+static void mark_free(void *bp, size_t size);
+static int size_class(size_t size);
+static void set_head(int i, char *bp);
+static void insert_free_block(void *bp);
+static void remove_free_block(void *bp);
+#ifdef BEST_FIT
+static char *splay(char *t, size_t size);
+static void tree_insert(int i, char *bp);
+static void tree_remove(int i, char *bp);
+static char *tree_fit(int i, size_t asize);
+#endif
+static void *block_malloc(size_t asize);
+static void block_free(void *bp);
+static void trim_heap(void *bp);
+#if DEFER_COALESCE
+static void quick_push(void *bp);
+static void *quick_pop(size_t asize);
+static void quick_flush(void);
+#endif
+static size_t map_len(size_t size);
+static void *map_malloc(size_t size);
+static void *map_realloc(void *ptr, size_t size);
+#if SLAB
+static int is_slab(void *bp);
+static void *slab_malloc(size_t size);
+static void slab_free(void *bp);
+static char *slab_new(size_t size);
+static char *slab_block(void);
+static char *slab_start(char *bp);
+static int slab_map(char *s, int set);
+static void slab_push(int c, char *s);
+static void slab_unlink(int c, char *s);
+#endif
 static void printblock(void *bp);
 static void checkheap(int verbose);
 static void checkblock(void *bp);
 
-/* 
+/*
  * mm_init - initialize the malloc package.
- * 1. Prologue block would have 4 words:
- * [Prologue header | next | prev (= NULL) | prologue footer]
- * 2. Epilogue block would be the same as in implicit list.
- * 3. Normal block would have minimum size of 6 words = 24 bytes.
- * 6 = 2 (header + footer) + 2 (pred + succ) + 2 (alignment requirement)
+ * 0. The heap starts with NUM_HEADS list heads (free lists, then slab
+ * lists and the page map), all NULL.
+ * 1. Prologue block would have 2 words: [Prologue header | prologue footer]
+ * 2. Epilogue block would be the same as in implicit list, except that it
+ * also carries the PREV_ALLOC bit.
+ * 3. Normal block would have minimum size of MIN_BLOCKSIZE bytes:
+ * header + next + prev + footer while free.
  */
 int mm_init(void) {
-    // printf("\nmm_init() called!\n");
-    if ((heap_listp = mem_sbrk(6 * WSIZE)) == (void *)-1) return -1;
+    int i;
+
+    if ((seg_listp = mem_sbrk(NUM_HEADS * LSIZE + 4 * WSIZE)) == (void *)-1) return -1;
 
+    for (i = 0; i < NUM_HEADS; i++)
+        PUTL(HEADP(i), 0);                          /* Empty size class */
+    class_map = 0;
+    quick_count = 0;
+    growth = 0;
+    requests = grown_at = 0;
+
+    heap_listp = seg_listp + NUM_HEADS * LSIZE;
     PUT(heap_listp, 0);                            /* Alignment padding */
-    PUT(heap_listp + (1 * WSIZE), PACK(QSIZE, 1)); /* Prologue header */
-    PUT(heap_listp + (2 * WSIZE), 0);              /* Prologue next */
-    PUT(heap_listp + (3 * WSIZE), 0);              /* Prologue prev */
-    PUT(heap_listp + (4 * WSIZE), PACK(QSIZE, 1)); /* Prologue footer */
-    PUT(heap_listp + (5 * WSIZE), PACK(0, 1));     /* Epilogue header */
+    PUT(heap_listp + (1 * WSIZE), PACK(DSIZE, 1)); /* Prologue header */
+    PUT(heap_listp + (2 * WSIZE), PACK(DSIZE, 1)); /* Prologue footer */
+    PUT(heap_listp + (3 * WSIZE), PACK(0, PREV_ALLOC | 1)); /* Epilogue header */
 
-    heap_listp += (4 * WSIZE); /* heaplist_p */
-    free_listp = heap_listp;
+    heap_listp += (2 * WSIZE); /* heaplist_p */
 
     if (extend_heap(CHUNKSIZE / WSIZE) == NULL)
         return -1;
@@ -193,219 +543,344 @@ int mm_init(void) {
 }
 
 static void *extend_heap(size_t words) {
-    // printf("extend_heap() called!\n");
-    char *nextp; /* pointer to the second word (next pointer) of extended block */
     char *bp;
     size_t size;
 
     /* Allocate an even number of words to maintain alignment */
     size = (words % 2) ? (words + 1) * WSIZE : words * WSIZE;
 
-    if ((long)(nextp = mem_sbrk(size)) == -1) return NULL;
+    if ((long)(bp = mem_sbrk(size)) == -1) return NULL;
 
-    /* Initialize free block header/footer and the epilogue header */
-    bp = nextp + DSIZE;
-    PUT(HDRP(bp), PACK(size, 0));         /* header */
-    PUT(FTRP(bp), PACK(size, 0));         /* footer */
+    /* Initialize free block header/footer and the epilogue header. The
+     * old epilogue header becomes the new block's header and keeps its
+     * PREV_ALLOC bit. */
+    mark_free(bp, size);
     PUT(HDRP(SUCC_BLKP(bp)), PACK(0, 1)); /* New epilogue header */
 
-    // Keep in mind: 
+    // Keep in mind:
     // 1. coalesce() cannot be called until header and footer are updated.
-    // 2. You should call coalesce only on a block pointer that have not been 
+    // 2. You should call coalesce only on a block pointer that have not been
     // put on the free list. This is the assumption made by coalesce().
     return coalesce(bp);
 }
 
-/**
- * mm_free() would only setting the allocation bit to 0 in header and footer.
- * The newly freed block is not put onto the free list by mm_free(): this is
- * handled by coalesce.
-*/
-static void *coalesce(void *bp) {
-#ifdef DEBUG_MODE
-    printf("coalesce() called!\n");
-#endif
+/*
+ * grow_size - Bytes to extend the heap by for a request of asize bytes
+ * that found no fit. A free block at the end of the heap merges with the
+ * new space, so only the rest is needed. When the heap grew only a few
+ * requests ago, this is a burst: the growth step doubles, starting from
+ * CHUNKSIZE, so a burst takes a logarithmic number of mem_sbrk calls.
+ * Otherwise the heap grows by the exact shortfall, so a heap near its
+ * peak does not end in unused space.
+ */
+static size_t grow_size(size_t asize) {
+    char *brk = (char *)mem_heap_hi() + 1;
+    size_t tail = GET_PREV_ALLOC(HDRP(brk)) ? 0 : GET_SIZE(brk - DSIZE);
+    size_t need = (tail < asize) ? asize - tail : asize;
 
-    size_t prev_alloc = GET_ALLOC(FTRP(PRED_BLKP(bp)));
-    size_t next_alloc = GET_ALLOC(HDRP(SUCC_BLKP(bp)));
-    size_t size = GET_SIZE(HDRP(bp));
+    if (requests - grown_at <= GROW_WINDOW)
+        growth = growth ? MIN(2 * growth, GROW_MAX) : CHUNKSIZE;
+    else
+        growth = 0;
+    grown_at = requests;
+    return MAX(need, growth);
+}
 
-#ifdef DEBUG_MODE
-    if (prev_alloc && next_alloc) {
-        printf("case 1, neither free\n");
-    } else if (prev_alloc) {
-        printf("case 2, successor free\n");
-    } else if (next_alloc) {
-        printf("case 3, predecessor free\n");
-    } else {
-        printf("case 4, both free\n");
-    }
-#endif
+/*
+ * mark_free - Write the header and footer of free block bp of the given
+ * size, keeping the PREV_ALLOC bit of its header.
+ */
+static void mark_free(void *bp, size_t size) {
+    PUT(HDRP(bp), PACK(size, GET_PREV_ALLOC(HDRP(bp))));
+    PUT(FTRP(bp), PACK(size, 0));
+}
 
-    if (prev_alloc && next_alloc) { /* Case 1 */
-        // Both predcessor and successor are allocated.
-        PUT(NEXTP(bp), HDRP(free_listp));
-        PUT(PREVP(bp), 0);
-        PUT(PREVP(NEXT_BLKP(bp)), HDRP(bp));
-        free_listp = bp;
-    }
+/*
+ * size_class - Map a block size to the index of its free list.
+ */
+static int size_class(size_t size) {
+    int i;
+
+    if (size <= SMALL_LIMIT)
+        return (size - MIN_BLOCKSIZE) / DSIZE;
+
+    /* (64, 128] -> TREE_CLASS, (128, 256] -> TREE_CLASS + 1, ...:
+     * TREE_CLASS plus the bit length of (size - 1) / 128, capped at the
+     * last class. With 16-byte minimum blocks, 16..64 are classes 0..6,
+     * TREE_CLASS is 7 and everything above 2^18 bytes shares class 19. */
+    size = (size - 1) >> 7;
+    i = TREE_CLASS;
+    if (size)
+        i += 8 * (int)sizeof(long) - __builtin_clzl(size);
+    return MIN(i, NUM_CLASSES - 1);
+}
 
-    else if (prev_alloc && !next_alloc) { /* Case 2 */
-        // Predecessor is allocated, successor is free
-        char *successor_bp;
-        successor_bp = SUCC_BLKP(bp); // This must be before adjusting size
+/*
+ * set_head - Make bp the head of size class i, keeping the class's bit in
+ * class_map in step.
+ */
+static void set_head(int i, char *bp) {
+    PUTL(HEADP(i), LINK(bp));
+    if (bp)
+        class_map |= 1u << i;
+    else
+        class_map &= ~(1u << i);
+}
 
-        // 1. Adjust the size
-        size += GET_SIZE(HDRP(SUCC_BLKP(bp)));
-        PUT(HDRP(bp), PACK(size, 0));
-        PUT(FTRP(bp), PACK(size, 0));
+/*
+ * insert_free_block - Push a free block on the front of its size class,
+ * or with ADDR_ORDER insert it before the first block above it.
+ */
+static void insert_free_block(void *bp) {
+    int i = size_class(GET_SIZE(HDRP(bp)));
+    char *head, *prev = NULL;
 
-        if (PREVV(successor_bp)) {
-#ifdef DEBUG_MODE
-                printf("case 2.1 \n");
+#ifdef BEST_FIT
+    if (i >= TREE_CLASS) {
+        tree_insert(i, bp);
+        return;
+    }
+#endif
+    head = HEAD_BLKP(i);
+#if ADDR_ORDER
+    while (head && head < (char *)bp) {
+        prev = head;
+        head = NEXT_BLKP(head);
+    }
 #endif
-            // 2. Change pointers of blocks of predecessor and successor
-            PUT(NEXTP(PREV_BLKP(successor_bp)), NEXTV(successor_bp));
-            PUT(PREVP(NEXT_BLKP(successor_bp)), PREVV(successor_bp));
+    PUTL(NEXTP(bp), LINK(head));
+    PUTL(PREVP(bp), LINK(prev));
+    if (head)
+        PUTL(PREVP(head), LINK(bp));
+    if (prev)
+        PUTL(NEXTP(prev), LINK(bp));
+    else
+        set_head(i, bp);
+}
 
-            // 3. Change pointers of the aggregated block
-            PUT(NEXTP(bp), HDRP(free_listp)); /* next points to original head of free list */
-            PUT(PREVP(bp), 0);                /* prev points to NULL */
-            PUT(PREVP(free_listp), HDRP(bp));
+/*
+ * remove_free_block - Unlink a free block from its size class. Must be
+ * called before the block's size changes.
+ */
+static void remove_free_block(void *bp) {
+    char *prev = PREV_BLKP(bp);
+    char *next = NEXT_BLKP(bp);
 
-            // 4. Update free list
-            free_listp = bp;
-        } else {
-#ifdef DEBUG_MODE            
-            printf("case 2.2 \n");
-#endif            
-            // 2. Change pointers of blocks of predecessor and successor
-            PUT(PREVP(NEXT_BLKP(successor_bp)), HDRP(bp));
-
-            // 3. Change pointers of the aggregated block
-            PUT(NEXTP(bp), HDRP(NEXT_BLKP(successor_bp))); /* next points to original head of free list */
-            PUT(PREVP(bp), 0);
-
-            // 4. Update free list
-            free_listp = bp;
-        }
+#ifdef BEST_FIT
+    /* Tree nodes need restructuring, chained blocks unlink like a list */
+    if (!prev && size_class(GET_SIZE(HDRP(bp))) >= TREE_CLASS) {
+        tree_remove(size_class(GET_SIZE(HDRP(bp))), bp);
+        return;
     }
+#endif
+    if (prev)
+        PUTL(NEXTP(prev), NEXTV(bp));
+    else
+        set_head(size_class(GET_SIZE(HDRP(bp))), next);
+    if (next)
+        PUTL(PREVP(next), PREVV(bp));
+}
 
-    else if (!prev_alloc && next_alloc) { /* Case 3 */
-        // Successor is allocated, predecessor is free
-
-        // 1. Adjust the size
-        size += GET_SIZE(HDRP(PRED_BLKP(bp)));
-        PUT(FTRP(bp), PACK(size, 0));
-        PUT(HDRP(PRED_BLKP(bp)), PACK(size, 0));
+#ifdef BEST_FIT
+/*
+ * splay - Top-down splay (Sleator and Tarjan) of the tree rooted at t for
+ * size. Returns the new root: the node of that size if there is one,
+ * otherwise its neighbour in size order. Left and right subtrees are
+ * assembled by hanging nodes off the "hooks" lhook/rhook, the link slots
+ * where the next node of each side belongs.
+ */
+static char *splay(char *t, size_t size) {
+    link_t lroot = 0, rroot = 0;
+    char *lhook = (char *)&lroot;
+    char *rhook = (char *)&rroot;
+    char *y;
 
-        bp = PRED_BLKP(bp);
+    if (t == NULL)
+        return NULL;
 
-        if (PREVV(bp)) {
-            // 2. Change pointers of blocks of predecessor and successor
-            PUT(NEXTP(PREV_BLKP(bp)), NEXTV(bp));
-            PUT(PREVP(NEXT_BLKP(bp)), PREVV(bp));
+    for (;;) {
+        if (size < GET_SIZE(HDRP(t))) {
+            if ((y = LEFT_BLKP(t)) == NULL)
+                break;
+            if (size < GET_SIZE(HDRP(y))) { /* Rotate right */
+                PUTL(LEFTP(t), GETL(RIGHTP(y)));
+                PUTL(RIGHTP(y), LINK(t));
+                t = y;
+                if (LEFT_BLKP(t) == NULL)
+                    break;
+            }
+            PUTL(rhook, LINK(t));            /* Link right */
+            rhook = LEFTP(t);
+            t = LEFT_BLKP(t);
+        } else if (size > GET_SIZE(HDRP(t))) {
+            if ((y = RIGHT_BLKP(t)) == NULL)
+                break;
+            if (size > GET_SIZE(HDRP(y))) { /* Rotate left */
+                PUTL(RIGHTP(t), GETL(LEFTP(y)));
+                PUTL(LEFTP(y), LINK(t));
+                t = y;
+                if (RIGHT_BLKP(t) == NULL)
+                    break;
+            }
+            PUTL(lhook, LINK(t));            /* Link left */
+            lhook = RIGHTP(t);
+            t = RIGHT_BLKP(t);
+        } else {
+            break;
+        }
+    }
 
-            // 3. Change pointers of the aggregated block
-            PUT(NEXTP(bp), HDRP(free_listp)); /* next points to original head of free list */
-            PUT(PREVP(bp), 0);                /* prev points to NULL */
-            PUT(PREVP(free_listp), HDRP(bp));
+    /* Assemble */
+    PUTL(lhook, GETL(LEFTP(t)));
+    PUTL(rhook, GETL(RIGHTP(t)));
+    PUTL(LEFTP(t), lroot);
+    PUTL(RIGHTP(t), rroot);
+    return t;
+}
 
-            // 4. Update free list
-            free_listp = bp;
-        } else {
-            // 2. Change pointers of blocks of predecessor and successor
-            // Nothing done
+/*
+ * tree_insert - Add free block bp to the tree of class i. A block whose
+ * size is already in the tree joins that node's chain.
+ */
+static void tree_insert(int i, char *bp) {
+    size_t size = GET_SIZE(HDRP(bp));
+    char *root = splay(HEAD_BLKP(i), size);
 
-            // 3. Change pointers of the aggregated block
-            // Nothing done
+    if (root && GET_SIZE(HDRP(root)) == size) {
+        char *next = NEXT_BLKP(root);
 
-            // 4. Update free list
-            // Nothing done
-        }
+        PUTL(NEXTP(bp), NEXTV(root));
+        PUTL(PREVP(bp), LINK(root));
+        if (next)
+            PUTL(PREVP(next), LINK(bp));
+        PUTL(NEXTP(root), LINK(bp));
+        set_head(i, root);
+        return;
     }
 
-    else { /* Case 4 */
-        // Both predecessor and successor are free
-
-        // 1. Adjust the size
-        size += GET_SIZE(HDRP(PRED_BLKP(bp))) + GET_SIZE(FTRP(SUCC_BLKP(bp)));
-        PUT(HDRP(PRED_BLKP(bp)), PACK(size, 0));
-        PUT(FTRP(SUCC_BLKP(bp)), PACK(size, 0));
+    PUTL(NEXTP(bp), 0);
+    PUTL(PREVP(bp), 0);
+    if (root == NULL) {
+        PUTL(LEFTP(bp), 0);
+        PUTL(RIGHTP(bp), 0);
+    } else if (size < GET_SIZE(HDRP(root))) {
+        PUTL(LEFTP(bp), GETL(LEFTP(root)));
+        PUTL(RIGHTP(bp), LINK(root));
+        PUTL(LEFTP(root), 0);
+    } else {
+        PUTL(RIGHTP(bp), GETL(RIGHTP(root)));
+        PUTL(LEFTP(bp), LINK(root));
+        PUTL(RIGHTP(root), 0);
+    }
+    set_head(i, bp);
+}
 
-        if (PREVV(PRED_BLKP(bp)) && PREVV(SUCC_BLKP(bp))) {
-#ifdef DEBUG_MODE
-            printf("coalesce(): case 4.1 \n");
-#endif
-            // Neither predecessor or successor is at the start of the free list
-            
-            // 2. Change pointers of blocks of predecessor and successor
-            PUT(NEXTP(PREV_BLKP(PRED_BLKP(bp))), NEXTV(PRED_BLKP(bp)));
-            PUT(PREVP(NEXT_BLKP(PRED_BLKP(bp))), PREVV(PRED_BLKP(bp)));
-            
-            PUT(NEXTP(PREV_BLKP(SUCC_BLKP(bp))), NEXTV(SUCC_BLKP(bp)));
-            PUT(PREVP(NEXT_BLKP(SUCC_BLKP(bp))), PREVV(SUCC_BLKP(bp)));
-
-            bp = PRED_BLKP(bp);
-
-            // 3. Change pointers of the aggregated block
-            PUT(NEXTP(bp), HDRP(free_listp)); 
-            PUT(PREVP(bp), 0);     
-            PUT(PREVP(free_listp), HDRP(bp));    
-
-            // 4. Update free list
-            free_listp = bp;
-        } else if (!PREVV(PRED_BLKP(bp))){
-#ifdef DEBUG_MODE
-            printf("coalesce(): case 4.2 \n");
-#endif            
-            // Predecessor is at the start of the free list
+/*
+ * tree_remove - Remove tree node bp from the tree of class i. If other
+ * blocks of its size are chained to it, the first of them takes its
+ * place; otherwise its subtrees are joined.
+ */
+static void tree_remove(int i, char *bp) {
+    size_t size = GET_SIZE(HDRP(bp));
+    char *next = NEXT_BLKP(bp);
+    char *root;
+
+    splay(HEAD_BLKP(i), size); /* bp is now the root */
+
+    if (next) {
+        PUTL(PREVP(next), 0);
+        PUTL(LEFTP(next), GETL(LEFTP(bp)));
+        PUTL(RIGHTP(next), GETL(RIGHTP(bp)));
+        root = next;
+    } else if (LEFT_BLKP(bp) == NULL) {
+        root = RIGHT_BLKP(bp);
+    } else {
+        /* Splaying the left subtree for size brings its maximum to the
+         * root, which then has no right child */
+        root = splay(LEFT_BLKP(bp), size);
+        PUTL(RIGHTP(root), GETL(RIGHTP(bp)));
+    }
+    set_head(i, root);
+}
 
-            // 2. Change pointers of blocks of successor
-            PUT(NEXTP(PREV_BLKP(SUCC_BLKP(bp))), NEXTV(SUCC_BLKP(bp)));
-            PUT(PREVP(NEXT_BLKP(SUCC_BLKP(bp))), PREVV(SUCC_BLKP(bp)));
+/*
+ * tree_fit - Smallest block in the tree of class i that holds asize, or
+ * NULL. Prefers a chained block, which leaves the tree untouched when it
+ * is removed.
+ */
+static char *tree_fit(int i, size_t asize) {
+    char *bp = splay(HEAD_BLKP(i), asize);
 
-            bp = PRED_BLKP(bp);
+    set_head(i, bp);
+    if (bp == NULL)
+        return NULL;
 
-            // 3. Change pointers of the aggregated block
-            // Nothing done        
+    if (GET_SIZE(HDRP(bp)) < asize) {
+        /* The root is the largest block too small: take its successor */
+        if ((bp = RIGHT_BLKP(bp)) == NULL)
+            return NULL;
+        while (LEFT_BLKP(bp))
+            bp = LEFT_BLKP(bp);
+    }
+    return NEXTV(bp) ? NEXT_BLKP(bp) : bp;
+}
+#endif
 
-            // 4. Update free list
-            // Nothing done
-        } else if (!PREVV(SUCC_BLKP(bp))) {
+/**
+ * mm_free() would only setting the allocation bit to 0 in header and footer.
+ * The newly freed block is not put onto the free list by mm_free(): this is
+ * handled by coalesce.
+*/
+static void *coalesce(void *bp) {
 #ifdef DEBUG_MODE
-            printf("coalesce(): case 4.3 \n");
+    printf("coalesce() called!\n");
 #endif
-            // Successor is at the start of the free list
-            char *successor_bp;
 
-            // 2. Change pointers of blocks of predecessor
-            PUT(NEXTP(PREV_BLKP(PRED_BLKP(bp))), NEXTV(PRED_BLKP(bp)));
-            PUT(PREVP(NEXT_BLKP(PRED_BLKP(bp))), PREVV(PRED_BLKP(bp)));
+    size_t prev_alloc = GET_PREV_ALLOC(HDRP(bp));
+    size_t next_alloc = GET_ALLOC(HDRP(SUCC_BLKP(bp)));
+    size_t size = GET_SIZE(HDRP(bp));
 
-            successor_bp = SUCC_BLKP(bp);
-            bp = PRED_BLKP(bp);
+    if (prev_alloc && next_alloc) { /* Case 1 */
+        // Both predcessor and successor are allocated.
+    }
 
-            // 3. Change pointers of the aggregated block
-            PUT(NEXTP(bp), NEXTV(successor_bp));
-            PUT(PREVP(bp), 0);
+    else if (prev_alloc && !next_alloc) { /* Case 2 */
+        // Predecessor is allocated, successor is free
+        remove_free_block(SUCC_BLKP(bp));
+        size += GET_SIZE(HDRP(SUCC_BLKP(bp)));
+        mark_free(bp, size);
+    }
 
-            PUT(PREVP(NEXT_BLKP(successor_bp)), HDRP(bp));
+    else if (!prev_alloc && next_alloc) { /* Case 3 */
+        // Successor is allocated, predecessor is free
+        remove_free_block(PRED_BLKP(bp));
+        size += GET_SIZE(HDRP(PRED_BLKP(bp)));
+        bp = PRED_BLKP(bp);
+        mark_free(bp, size);
+    }
 
-            // 4. Update free list
-            free_listp = bp;
-        }
+    else { /* Case 4 */
+        // Both predecessor and successor are free
+        remove_free_block(PRED_BLKP(bp));
+        remove_free_block(SUCC_BLKP(bp));
+        size += GET_SIZE(HDRP(PRED_BLKP(bp))) + GET_SIZE(HDRP(SUCC_BLKP(bp)));
+        bp = PRED_BLKP(bp);
+        mark_free(bp, size);
     }
 
+    /* The block after a free block never has PREV_ALLOC set */
+    CLR_PREV_ALLOC(HDRP(SUCC_BLKP(bp)));
+    insert_free_block(bp);
+
     mm_checkheap(1);
     return bp;
 }
 
 /*
  * mm_free
- * 
- * mm_free only sets the allocation bits of header and footer. It does not put
- * the block in the free list. This is done by function coalesce().
+ *
+ * mm_free only clears the allocation bit and writes the footer back. It does
+ * not put the block in the free list. This is done by function coalesce().
  */
 void mm_free(void *bp) {
 #ifdef DEBUG_MODE
@@ -418,19 +893,135 @@ void mm_free(void *bp) {
         mm_init();
     }
 
+#if SLAB
+    if (is_slab(bp)) {
+        slab_free(bp);
+        return;
+    }
+#endif
+    if (IS_MAPPED(bp)) {
+        mem_unmap(MAP_BASE(bp));
+        return;
+    }
+#if DEFER_COALESCE
+    if (GET_SIZE(HDRP(bp)) <= QUICK_LIMIT) {
+        quick_push(bp);
+        return;
+    }
+#endif
+    block_free(bp);
+}
+
+/*
+ * block_free - Free a block of the general heap. If that leaves a large
+ * free block, the heap is trimmed or the block's pages are released.
+ *
+ * Pages are released for the span of the freed block, widened over any
+ * free neighbour too small to have been released itself. The free-list
+ * links and tree links at the start of the block and its footer are kept.
+ */
+static void block_free(void *bp) {
     size_t size = GET_SIZE(HDRP(bp));
+    size_t prev = GET_PREV_ALLOC(HDRP(bp)) ? 0 : GET_SIZE((char *)bp - DSIZE);
+    size_t next = GET_ALLOC(HDRP(SUCC_BLKP(bp))) ? 0 : GET_SIZE(HDRP(SUCC_BLKP(bp)));
+    char *lo = HDRP(bp), *hi = HDRP(bp) + size;
+    char *fp;
+
+    // Clear the allocation bit in the header and write the footer
+    mark_free(bp, size);
+
+    fp = coalesce(bp);
+    size = GET_SIZE(HDRP(fp));
+
+    if (TRIM_THRESHOLD && size >= TRIM_THRESHOLD &&
+        GET_SIZE(HDRP(SUCC_BLKP(fp))) == 0) {
+        trim_heap(fp);
+    } else if (RELEASE_THRESHOLD && size >= RELEASE_THRESHOLD) {
+        if (prev && prev < RELEASE_THRESHOLD)
+            lo -= prev;
+        if (next && next < RELEASE_THRESHOLD)
+            hi += next;
+        lo = MAX(lo, fp + 4 * LSIZE);
+        hi = MIN(hi, FTRP(fp));
+        if (lo < hi)
+            mem_release(lo, hi - lo);
+    }
+}
 
-    // Update allocation bit in header and footer
-    PUT(HDRP(bp), PACK(size, 0));
-    PUT(FTRP(bp), PACK(size, 0));
+/*
+ * trim_heap - Shrink the heap so that its last block, free block bp,
+ * keeps TRIM_PAD bytes.
+ */
+static void trim_heap(void *bp) {
+    size_t size = GET_SIZE(HDRP(bp)), step;
+
+    remove_free_block(bp);
+    mark_free(bp, TRIM_PAD);
+    PUT(HDRP(SUCC_BLKP(bp)), PACK(0, 1)); /* New epilogue header */
+    insert_free_block(bp);
+
+    /* mem_sbrk takes an int, so a tail of 2 GB or more goes in pieces */
+    for (size -= TRIM_PAD; size > 0; size -= step) {
+        step = MIN(size, (size_t)INT_MAX / DSIZE * DSIZE);
+        mem_sbrk(-(int)step);
+    }
+}
 
-    coalesce(bp);
+#if DEFER_COALESCE
+/*
+ * quick_push - Put freed block bp on the quick list of its size, leaving
+ * it marked allocated.
+ */
+static void quick_push(void *bp) {
+    char *headp = QUICK_HEADP(GET_SIZE(HDRP(bp)));
+
+    PUT(HDRP(bp), GET(HDRP(bp)) & ~REALLOC_TAG);
+    PUTL(NEXTP(bp), GETL(headp));
+    PUTL(headp, LINK(bp));
+    if (++quick_count >= QUICK_MAX)
+        quick_flush();
+}
+
+/*
+ * quick_pop - Take a block of exactly asize bytes off its quick list, or
+ * return NULL. The block is still marked allocated.
+ */
+static void *quick_pop(size_t asize) {
+    char *headp, *bp;
+
+    if (asize > QUICK_LIMIT)
+        return NULL;
+    headp = QUICK_HEADP(asize);
+    if ((bp = UNLINK(GETL(headp))) != NULL) {
+        PUTL(headp, NEXTV(bp));
+        quick_count--;
+    }
+    return bp;
+}
+
+/*
+ * quick_flush - Free every block on the quick lists for real, coalescing
+ * each with its free neighbours.
+ */
+static void quick_flush(void) {
+    char *headp, *bp;
+    size_t size;
+
+    for (size = DSIZE; size <= QUICK_LIMIT; size += DSIZE) {
+        headp = QUICK_HEADP(size);
+        while ((bp = UNLINK(GETL(headp))) != NULL) {
+            PUTL(headp, NEXTV(bp));
+            quick_count--;
+            block_free(bp);
+        }
+    }
 }
+#endif
 
-/* 
+/*
  * mm_malloc - Allocate a block by incrementing the brk pointer.
  *     Always allocate a block whose size is a multiple of the alignment.
- * 
+ *
  * Parameter:
  * size: number of bytes required to be allocated.
  */
@@ -439,10 +1030,6 @@ void *mm_malloc(size_t size) {
     printf("mm_malloc() called! size = %d \n", size);
 #endif
 
-    size_t asize;      /* Adjusted block size */
-    size_t extendsize; /* Amount to extend heap if no fit */
-    char *bp;          /* Block pointer */
-
     if (heap_listp == 0) {
         mm_init();
     }
@@ -450,31 +1037,37 @@ void *mm_malloc(size_t size) {
     if (size == 0)
         return NULL;
 
-    /* Adjust block size to include overhead and alignment reqs. */
-    if (size <= DSIZE)
-        asize = MIN_BLOCKSIZE;
-    else
-        asize = DSIZE * ((size + (QSIZE) + (DSIZE - 1)) / DSIZE);
+#if SLAB
+    if (size <= SLAB_LIMIT)
+        return slab_malloc(DSIZE * ((size + (DSIZE - 1)) / DSIZE));
+#endif
+    if (MMAP_THRESHOLD && size >= MMAP_THRESHOLD)
+        return map_malloc(size);
+    return block_malloc(adjust_size(size));
+}
 
-#ifdef DEBUG_MODE
-    printf("adjusted size: %d\n", asize);
+/*
+ * block_malloc - Allocate a block of asize bytes from the general heap.
+ */
+static void *block_malloc(size_t asize) {
+    size_t extendsize; /* Amount to extend heap if no fit */
+    char *bp;          /* Block pointer */
+
+    requests++;
+#if DEFER_COALESCE
+    /* A block of the same size freed lately is still allocated */
+    if ((bp = quick_pop(asize)) != NULL)
+        return bp;
 #endif
 
-    /* Search the free list for a fit */
+    /* Search the free lists for a fit */
     if ((bp = find_fit(asize)) != NULL) {
-#ifdef DEBUG_MODE
-        // printf("find_fit: %p\n", bp);
-#endif
         place(bp, asize);
         return bp;
     }
 
-#ifdef DEBUG_MODE
-    printf("find_fit() returns NULL!\n");
-#endif
-
     /* No fit found. Get more memory and place the block */
-    extendsize = MAX(asize, CHUNKSIZE);
+    extendsize = grow_size(asize);
     if ((bp = extend_heap(extendsize / WSIZE)) == NULL) return NULL;
     place(bp, asize);
 
@@ -482,9 +1075,18 @@ void *mm_malloc(size_t size) {
     return bp;
 }
 
+/*
+ * adjust_size - Block size for a payload of size bytes, including
+ * overhead and alignment.
+ */
+static size_t adjust_size(size_t size) {
+    return MAX(MIN_BLOCKSIZE, DSIZE * ((size + WSIZE + (DSIZE - 1)) / DSIZE));
+}
+
 /**
  * Current policy: always split the block if the remaining is not smaller
- * than the minimum block size.
+ * than the minimum block size. The remainder goes back on the list of
+ * its own size class.
  */
 static void place(void *bp, size_t asize) {
 #ifdef DEBUG_MODE
@@ -492,79 +1094,382 @@ static void place(void *bp, size_t asize) {
 #endif
 
     size_t csize = GET_SIZE(HDRP(bp));
+    unsigned int prev_alloc = GET_PREV_ALLOC(HDRP(bp));
+
+    remove_free_block(bp);
 
     if ((csize - asize) >= MIN_BLOCKSIZE) {
-        char *allocated_bp, *remaining_bp;
+        char *remaining_bp;
 
-        allocated_bp = bp;
-        PUT(HDRP(allocated_bp), PACK(asize, 1));
-        PUT(FTRP(allocated_bp), PACK(asize, 1));
+        PUT(HDRP(bp), PACK(asize, prev_alloc | 1));
 
-        // Update header and footer
-        remaining_bp = SUCC_BLKP(allocated_bp);
-        PUT(HDRP(remaining_bp), PACK(csize - asize, 0));
+        remaining_bp = SUCC_BLKP(bp);
+        PUT(HDRP(remaining_bp), PACK(csize - asize, PREV_ALLOC));
         PUT(FTRP(remaining_bp), PACK(csize - asize, 0));
-
-        // Update free list pointers
-        if (PREVV(allocated_bp)) {
-            PUT(NEXTP(PREV_BLKP(allocated_bp)), HDRP(remaining_bp));
-            PUT(PREVP(remaining_bp), PREVV(allocated_bp));
-        } else {
-            free_listp = remaining_bp;
-            PUT(PREVP(remaining_bp), 0);
-        }
-        PUT(NEXTP(remaining_bp), NEXTV(allocated_bp));
-        PUT(PREVP(NEXT_BLKP(allocated_bp)), HDRP(remaining_bp));
+        insert_free_block(remaining_bp);
     } else {
-        PUT(HDRP(bp), PACK(csize, 1));
-        PUT(FTRP(bp), PACK(csize, 1));
-
-        // Update free list pointers
-        if (PREVV(bp)) {
-            PUT(NEXTP(PREV_BLKP(bp)), NEXTV(bp));
-            PUT(PREVP(NEXT_BLKP(bp)), PREVV(bp));
-        } else {
-            free_listp = NEXT_BLKP(bp);
-            PUT(PREVP(NEXT_BLKP(bp)), 0);
-        }
+        PUT(HDRP(bp), PACK(csize, prev_alloc | 1));
+        SET_PREV_ALLOC(HDRP(SUCC_BLKP(bp)));
     }
 
     mm_checkheap(1);
 }
 
+/*
+ * find_fit - Find a free block of at least asize bytes, or NULL. With
+ * DEFER_COALESCE, a miss first frees the quick lists and searches again,
+ * so the heap does not grow while mergeable blocks wait there.
+ */
 static void *find_fit(size_t asize) {
-    void *bp;
+    void *bp = class_fit(asize);
+
+#if DEFER_COALESCE
+    if (bp == NULL && quick_count > 0) {
+        quick_flush();
+        bp = class_fit(asize);
+    }
+#endif
+    return bp;
+}
+
+/*
+ * class_fit - Search the request's own size class, then the first
+ * non-empty larger class, which class_map gives in one step. Every block
+ * in a larger class fits. A small class holds a single size, so only a
+ * request in a class above SMALL_LIMIT has to search its own class.
+ *
+ * First-fit takes the first block that fits. Best-fit relies on the small
+ * classes holding a single size each, so their head is the best block,
+ * and on the splay trees of the larger classes to find the smallest
+ * sufficient block in O(log n) amortized time.
+ */
+static void *class_fit(size_t asize) {
+    char *bp;
+    unsigned int map;
+    int i = size_class(asize);
+
+    if (i >= TREE_CLASS) {
+        if (class_map & (1u << i)) {
 #ifdef BEST_FIT
-    void *best_bp = NULL;
-    int diff = MAX_INT;
-
-    for (bp = free_listp; GET_SIZE(HDRP(bp)) > QSIZE; bp = NEXT_BLKP(bp)) {
-        if (!GET_ALLOC(HDRP(bp)) && (asize <= GET_SIZE(HDRP(bp)))) {
-            if (GET_SIZE(HDRP(bp)) - asize < diff) {
-                best_bp = bp;
-                diff = GET_SIZE(HDRP(bp)) - asize;
+            if ((bp = tree_fit(i, asize)) != NULL)
+                return bp;
+#else
+            // first fit
+            for (bp = HEAD_BLKP(i); bp != NULL; bp = NEXT_BLKP(bp)) {
+                if (asize <= GET_SIZE(HDRP(bp)))
+                    return bp;
             }
+#endif
         }
+        i++;
     }
 
-    return best_bp ? best_bp : NULL;
+    if ((map = class_map & (~0u << i)) == 0)
+        return NULL;
+    i = __builtin_ctz(map);
+#ifdef BEST_FIT
+    return (i < TREE_CLASS) ? HEAD_BLKP(i) : tree_fit(i, asize);
 #else
-    // first fit
-    for (bp = free_listp; GET_SIZE(HDRP(bp)) > QSIZE; bp = NEXT_BLKP(bp)) {
-        if (!GET_ALLOC(HDRP(bp)) && (asize <= GET_SIZE(HDRP(bp)))) {
-            return bp;
-        }
+    return HEAD_BLKP(i);
+#endif
+}
+
+#if SLAB
+/*
+ * is_slab - Whether bp is an object in a slab rather than a block of the
+ * general heap. No block payload starts in a slab page, so the page map
+ * alone decides.
+ */
+static int is_slab(void *bp) {
+    size_t page = SLAB_PAGE(bp);
+    char *map = UNLINK(GETL(SLAB_MAPP));
+
+    if (page >= GETL(SLAB_PAGESP))
+        return 0;
+    return (GET(map + page / 32 * WSIZE) >> (page % 32)) & 1;
+}
+
+/*
+ * slab_malloc - Take the first free object of a slab of the given size
+ * (a multiple of 8), starting a new slab if the class has none.
+ */
+static void *slab_malloc(size_t size) {
+    int c = size / DSIZE - 1;
+    char *s = UNLINK(GETL(SLAB_HEADP(c)));
+    char *bits;
+    unsigned int word;
+    int i;
+
+    if (s == NULL) {
+        if ((s = slab_new(size)) == NULL)
+            return NULL;
+        slab_push(c, s);
+    }
+
+    for (bits = SLAB_BITSP(s); GET(bits) == 0; bits += WSIZE)
+        ;
+    word = GET(bits);
+    i = (bits - SLAB_BITSP(s)) / WSIZE * 32 + __builtin_ctz(word);
+    PUT(bits, word & (word - 1));
+
+    PUT(SLAB_NFREEP(s), GET(SLAB_NFREEP(s)) - 1);
+    if (GET(SLAB_NFREEP(s)) == 0)
+        slab_unlink(c, s);
+
+    mm_checkheap(1);
+    return s + SLAB_HDRSIZE + i * size;
+}
+
+/*
+ * slab_free - Return an object to its slab. A slab that becomes empty
+ * goes back to the general heap, unless it is the only one of its class
+ * with free objects.
+ */
+static void slab_free(void *bp) {
+    char *s = SLAB_BASE(bp);
+    size_t size = GET(SLAB_OBJSIZEP(s));
+    int c = size / DSIZE - 1;
+    int i = ((char *)bp - s - SLAB_HDRSIZE) / size;
+    char *bits = SLAB_BITSP(s) + i / 32 * WSIZE;
+    unsigned int nfree = GET(SLAB_NFREEP(s)) + 1;
+
+    PUT(bits, GET(bits) | (1u << (i % 32)));
+    PUT(SLAB_NFREEP(s), nfree);
+
+    if (nfree == 1) {
+        slab_push(c, s);
+    } else if (nfree == SLAB_OBJS(size) &&
+               (GETL(SLAB_HEADP(c)) != LINK(s) || GETL(SLAB_NEXTP(s)))) {
+        slab_unlink(c, s);
+        slab_map(s, 0);
+        block_free(s);
+    }
+
+    mm_checkheap(1);
+}
+
+/*
+ * slab_new - Set up an empty slab for objects of the given size.
+ */
+static char *slab_new(size_t size) {
+    char *s;
+    int i, n = SLAB_OBJS(size);
+
+    if ((s = slab_block()) == NULL)
+        return NULL;
+    if (slab_map(s, 1) < 0) {
+        block_free(s);
+        return NULL;
+    }
+
+    PUT(SLAB_OBJSIZEP(s), size);
+    PUT(SLAB_NFREEP(s), n);
+    for (i = 0; i < SLAB_BITWORDS; i++, n -= 32)
+        PUT(SLAB_BITSP(s) + i * WSIZE,
+            n >= 32 ? ~0u : n > 0 ? (1u << n) - 1 : 0);
+    return s;
+}
+
+/*
+ * slab_block - Allocate a block of SLAB_SIZE bytes whose payload starts
+ * on a slab boundary. Any free space before the boundary is split off as
+ * a free block. If no free block is big enough for every alignment, the
+ * heap is extended just far enough to end a slab.
+ */
+static char *slab_block(void) {
+    char *bp, *brk, *s;
+    size_t csize, lead;
+
+    if ((bp = find_fit(2 * SLAB_SIZE + MIN_BLOCKSIZE)) == NULL) {
+        /* A new block starts where the epilogue header is now */
+        brk = (char *)mem_heap_hi() + 1;
+        if ((bp = extend_heap((slab_start(brk) + SLAB_SIZE - brk) / WSIZE)) == NULL)
+            return NULL;
+    }
+
+    s = slab_start(bp);
+    lead = s - bp;
+    if (lead) {
+        csize = GET_SIZE(HDRP(bp));
+        remove_free_block(bp);
+        mark_free(bp, lead);
+        insert_free_block(bp);
+        PUT(HDRP(s), PACK(csize - lead, 0));
+        PUT(FTRP(s), PACK(csize - lead, 0));
+        insert_free_block(s);
+    }
+    place(s, SLAB_SIZE);
+    return s;
+}
+
+/*
+ * slab_start - First slab boundary in free block bp that leaves either
+ * nothing or a whole free block before it.
+ */
+static char *slab_start(char *bp) {
+    char *s = SLAB_ALIGN(bp);
+
+    if (s != bp && s - bp < MIN_BLOCKSIZE)
+        s += SLAB_SIZE;
+    return s;
+}
+
+/*
+ * slab_map - Set or clear the page map bit of slab s. Setting a bit
+ * beyond the end of the map first replaces the map with one covering
+ * twice the current heap. Returns -1 if that fails.
+ */
+static int slab_map(char *s, int set) {
+    size_t page = SLAB_PAGE(s);
+    size_t pages = GETL(SLAB_PAGESP);
+    char *map = UNLINK(GETL(SLAB_MAPP));
+    char *newmap;
+
+    if (page >= pages) {
+        pages = (mem_heapsize() / SLAB_SIZE + 1) * 2;
+        pages = (pages + 31) / 32 * 32;
+        if ((newmap = block_malloc(adjust_size(pages / 8))) == NULL)
+            return -1;
+        memset(newmap, 0, pages / 8);
+        if (map)
+            memcpy(newmap, map, GETL(SLAB_PAGESP) / 8);
+
+        /* Publish the new map before the old one is freed, so nothing
+         * run by block_free looks at a map in a free block */
+        PUTL(SLAB_MAPP, LINK(newmap));
+        PUTL(SLAB_PAGESP, pages);
+        if (map)
+            block_free(map);
+        map = newmap;
     }
 
-    return NULL;
+    map += page / 32 * WSIZE;
+    if (set)
+        PUT(map, GET(map) | (1u << (page % 32)));
+    else
+        PUT(map, GET(map) & ~(1u << (page % 32)));
+    return 0;
+}
+
+/*
+ * slab_push - Put slab s at the front of the list of class c.
+ */
+static void slab_push(int c, char *s) {
+    char *head = UNLINK(GETL(SLAB_HEADP(c)));
+
+    PUTL(SLAB_NEXTP(s), LINK(head));
+    PUTL(SLAB_PREVP(s), 0);
+    if (head)
+        PUTL(SLAB_PREVP(head), LINK(s));
+    PUTL(SLAB_HEADP(c), LINK(s));
+}
+
+/*
+ * slab_unlink - Take slab s off the list of class c.
+ */
+static void slab_unlink(int c, char *s) {
+    char *prev = UNLINK(GETL(SLAB_PREVP(s)));
+    char *next = UNLINK(GETL(SLAB_NEXTP(s)));
+
+    if (prev)
+        PUTL(SLAB_NEXTP(prev), LINK(next));
+    else
+        PUTL(SLAB_HEADP(c), LINK(next));
+    if (next)
+        PUTL(SLAB_PREVP(next), LINK(prev));
+}
 #endif
+
+/*
+ * map_len - Length of the region that holds a payload of size bytes
+ */
+static size_t map_len(size_t size) {
+    size_t pagesize = mem_pagesize();
+
+    return (size + MMAP_HDRSIZE + pagesize - 1) / pagesize * pagesize;
+}
+
+/*
+ * map_malloc - Allocate a block in a region of its own.
+ */
+static void *map_malloc(size_t size) {
+    size_t len = map_len(size);
+    char *base;
+
+    if ((base = mem_map(len)) == (void *)-1)
+        return NULL;
+    *(size_t *)base = len;
+    PUT(base + MMAP_HDRSIZE - WSIZE, PACK(0, 1));
+    return base + MMAP_HDRSIZE;
 }
 
 /*
- * mm_realloc - Implemented simply in terms of mm_malloc and mm_free
+ * map_realloc - Resize a mapped block with mem_remap, which moves pages
+ * rather than copying them. A block that shrinks below MMAP_THRESHOLD
+ * moves into the heap.
+ */
+static void *map_realloc(void *ptr, size_t size) {
+    size_t len = map_len(size);
+    char *base;
+    void *newptr;
+
+    if (size < MMAP_THRESHOLD) {
+        if ((newptr = mm_malloc(size)) == NULL)
+            return NULL;
+        memcpy(newptr, ptr, size);
+        mem_unmap(MAP_BASE(ptr));
+        return newptr;
+    }
+
+    if (len == MAP_LEN(ptr))
+        return ptr;
+    if ((base = mem_remap(MAP_BASE(ptr), len)) == (void *)-1)
+        return NULL;
+    *(size_t *)base = len;
+    return base + MMAP_HDRSIZE;
+}
+
+/*
+ * realloc_place - Trim allocated block bp of size csize down to asize.
+ * The tail goes back to the free lists (coalescing with a free successor)
+ * if it can form a block of its own. The PREV_ALLOC bit and realloc tag
+ * are kept.
+ */
+static void realloc_place(void *bp, size_t csize, size_t asize) {
+    unsigned int bits = GET(HDRP(bp)) & (PREV_ALLOC | REALLOC_TAG);
+
+    if ((csize - asize) >= MIN_BLOCKSIZE) {
+        char *remaining_bp;
+
+        PUT(HDRP(bp), PACK(asize, bits | 1));
+
+        remaining_bp = SUCC_BLKP(bp);
+        PUT(HDRP(remaining_bp), PACK(csize - asize, PREV_ALLOC));
+        PUT(FTRP(remaining_bp), PACK(csize - asize, 0));
+        coalesce(remaining_bp);
+    } else {
+        PUT(HDRP(bp), PACK(csize, bits | 1));
+        SET_PREV_ALLOC(HDRP(SUCC_BLKP(bp)));
+    }
+}
+
+/*
+ * mm_realloc - Resize in place whenever the neighbourhood allows it:
+ * 1. Shrinking splits off the tail.
+ * 2. Growing absorbs a free successor if that makes the block big enough.
+ * 3. A block that is last on the heap (possibly followed by a free block)
+ *    grows by extending the heap by just the missing bytes.
+ * Only otherwise is the block moved with mm_malloc, memcpy and mm_free.
+ *
+ * A block that has grown before (REALLOC_TAG) asks for half again the
+ * requested size, so a block that keeps growing by small steps is moved
+ * or extended O(log n) times instead of on every call. Shrinking such a
+ * block keeps that slack.
  */
 void *mm_realloc(void *ptr, size_t size) {
-    size_t oldsize;
+    size_t asize, want, csize, avail;
+    size_t wsize = size; /* Payload size asked for, with any slack */
+    char *next, *end;
     void *newptr;
 
     /* If size == 0 then this is just free, and we return NULL. */
@@ -578,17 +1483,80 @@ void *mm_realloc(void *ptr, size_t size) {
         return mm_malloc(size);
     }
 
-    newptr = mm_malloc(size);
+#if SLAB
+    /* A slab object keeps its slot while the new size fits in it */
+    if (is_slab(ptr)) {
+        csize = GET(SLAB_OBJSIZEP(SLAB_BASE(ptr)));
+        if (size <= csize)
+            return ptr;
+        if ((newptr = mm_malloc(size)) == NULL)
+            return 0;
+        memcpy(newptr, ptr, csize);
+        slab_free(ptr);
+        return newptr;
+    }
+#endif
+
+    if (IS_MAPPED(ptr))
+        return map_realloc(ptr, size);
+
+    /* A heap block that grows this large moves to a region of its own */
+    if (MMAP_THRESHOLD && size >= MMAP_THRESHOLD) {
+        if ((newptr = map_malloc(size)) == NULL)
+            return 0;
+        memcpy(newptr, ptr, MIN(GET_SIZE(HDRP(ptr)) - WSIZE, size));
+        block_free(ptr);
+        return newptr;
+    }
+
+    if (GET_TAG(HDRP(ptr)))
+        wsize += size / 2;
+    asize = adjust_size(size);
+    want = adjust_size(wsize);
+    csize = GET_SIZE(HDRP(ptr));
+
+    /* Case 1: shrink (or already big enough) */
+    if (asize <= csize) {
+        realloc_place(ptr, csize, MIN(want, csize));
+        return ptr;
+    }
+
+    /* Room available without moving: the block plus a free successor */
+    next = SUCC_BLKP(ptr);
+    avail = csize;
+    if (!GET_ALLOC(HDRP(next)))
+        avail += GET_SIZE(HDRP(next));
+
+    /* Case 3: at the end of the heap, extend it by what is missing */
+    end = GET_ALLOC(HDRP(next)) ? next : SUCC_BLKP(next);
+    if (avail < want && GET_SIZE(HDRP(end)) == 0) {
+        if (extend_heap(MAX(want - avail, MIN_BLOCKSIZE) / WSIZE) == NULL)
+            return NULL;
+        avail = csize + GET_SIZE(HDRP(next));
+    }
+
+    /* Case 2: absorb the free successor */
+    if (avail >= asize) {
+        remove_free_block(next);
+        PUT(HDRP(ptr), PACK(avail, GET_PREV_ALLOC(HDRP(ptr)) | REALLOC_TAG | 1));
+        realloc_place(ptr, avail, MIN(want, avail));
+        return ptr;
+    }
+
+    newptr = mm_malloc(wsize);
 
     /* If realloc() fails the original block is left untouched  */
     if (!newptr) {
         return 0;
     }
 
-    /* Copy the old data. */
-    oldsize = GET_SIZE(HDRP(ptr));
-    if (size < oldsize) oldsize = size;
-    memcpy(newptr, ptr, oldsize);
+    /* Copy the old data; the new block is larger. */
+    memcpy(newptr, ptr, csize - WSIZE);
+#if SLAB
+    if (!is_slab(newptr))
+#endif
+        if (!IS_MAPPED(newptr))
+            PUT(HDRP(newptr), GET(HDRP(newptr)) | REALLOC_TAG);
 
     /* Free the old block. */
     mm_free(ptr);
@@ -596,13 +1564,43 @@ void *mm_realloc(void *ptr, size_t size) {
     return newptr;
 }
 
+/*
+ * mm_freestats - Count the free blocks of the heap, their total size
+ * and the size of the largest, for mdriver's timeline (-P). Free slab
+ * objects and mapped blocks are not counted; blocks on the quick lists
+ * are, each as a block of its own.
+ */
+void mm_freestats(size_t *count, size_t *total, size_t *largest) {
+    char *bp;
+    size_t size;
+
+    *count = *total = *largest = 0;
+    for (bp = heap_listp; GET_SIZE(HDRP(bp)) > 0; bp = SUCC_BLKP(bp)) {
+        if (GET_ALLOC(HDRP(bp)))
+            continue;
+        size = GET_SIZE(HDRP(bp));
+        (*count)++;
+        *total += size;
+        if (size > *largest)
+            *largest = size;
+    }
+#if DEFER_COALESCE
+    for (size = DSIZE; size <= QUICK_LIMIT; size += DSIZE) {
+        for (bp = UNLINK(GETL(QUICK_HEADP(size))); bp; bp = NEXT_BLKP(bp)) {
+            (*count)++;
+            *total += size;
+            if (size > *largest)
+                *largest = size;
+        }
+    }
+#endif
+}
+
 static void printblock(void *bp) {
     size_t hsize, halloc, fsize, falloc;
 
     hsize = GET_SIZE(HDRP(bp));
     halloc = GET_ALLOC(HDRP(bp));
-    fsize = GET_SIZE(FTRP(bp));
-    falloc = GET_ALLOC(FTRP(bp));
 
     if (hsize == 0) {
         printf("%p: End Of heap, ", bp);
@@ -610,35 +1608,33 @@ static void printblock(void *bp) {
         return;
     }
 
-    printf("%p: header: [%5ld:%c] footer: [%5ld:%c]\n", 
-            bp,  
-            hsize, (halloc ? 'a' : 'f'),  
+    if (halloc) {
+        printf("%p: header: [%5ld:a%s]\n", bp, hsize,
+               GET_PREV_ALLOC(HDRP(bp)) ? "" : " prev free");
+        return;
+    }
+
+    fsize = GET_SIZE(FTRP(bp));
+    falloc = GET_ALLOC(FTRP(bp));
+    printf("%p: header: [%5ld:%c] footer: [%5ld:%c]\n",
+            bp,
+            hsize, (halloc ? 'a' : 'f'),
             fsize, (falloc ? 'a' : 'f'));
 }
 
 void printfreeblock(void *bp) {
     size_t hsize, halloc, fsize, falloc;
-    char *next, *prev;
 
     hsize = GET_SIZE(HDRP(bp));
     halloc = GET_ALLOC(HDRP(bp));
     fsize = GET_SIZE(FTRP(bp));
     falloc = GET_ALLOC(FTRP(bp));
 
-    next = GET(NEXTP(bp));
-    prev = GET(PREVP(bp));
-
-    if (hsize == 0) {
-        printf("%p: End Of free list, ", bp);
-        printf("header: [%5ld:%c]\n", hsize, (halloc ? 'a' : 'f'));
-        return;
-    }
-
-    printf("%p: header: [%5ld:%c] next: [%p] prev: [%p] footer: [%5ld:%c]\n", 
-            bp, 
-            hsize, (halloc ? 'a' : 'f'),  
-            next, 
-            prev, 
+    printf("%p: header: [%5ld:%c] next: [%p] prev: [%p] footer: [%5ld:%c]\n",
+            bp,
+            hsize, (halloc ? 'a' : 'f'),
+            NEXT_BLKP(bp),
+            PREV_BLKP(bp),
             fsize, (falloc ? 'a' : 'f'));
 }
 
@@ -646,75 +1642,201 @@ static void checkblock(void *bp) {
     if ((size_t)bp % 8) {
         printf("Error: %p is not doubleword aligned\n", bp);
     }
-    if (GET(HDRP(bp)) != GET(FTRP(bp))) {
+    if (!GET_ALLOC(HDRP(bp)) && GET_SIZE(HDRP(bp)) != GET(FTRP(bp))) {
         printf("Error: header does not match footer\n");
     }
 }
 
-static void printfreelist() {
+/*
+ * checkfreeblock - Checks shared by every block on a free list or tree.
+ */
+static void checkfreeblock(void *bp, int i, int verbose) {
+    if (verbose)
+        printfreeblock(bp);
+    checkblock(bp);
+
+    if (GET_ALLOC(HDRP(bp)))
+        printf("### Allocated block %p in free list %d ###\n", bp, i);
+    if (size_class(GET_SIZE(HDRP(bp))) != i)
+        printf("### Block %p of size %u in wrong class %d ###\n",
+               bp, GET_SIZE(HDRP(bp)), i);
+    if (NEXT_BLKP(bp) && PREV_BLKP(NEXT_BLKP(bp)) != bp)
+        printf("### Broken prev link after %p ###\n", bp);
+    if ((char *)bp < (char *)mem_heap_lo() || (char *)bp > (char *)mem_heap_hi())
+        printf("### Free block %p outside heap ###\n", bp);
+}
+
+#ifdef BEST_FIT
+/*
+ * checktree - Check the subtree at bp of class i, whose sizes must lie in
+ * (lo, hi). Returns the number of blocks in the subtree and its chains.
+ */
+static int checktree(char *bp, int i, size_t lo, size_t hi, int verbose) {
+    char *cp;
+    size_t size;
+    int count = 0;
+
+    if (bp == NULL)
+        return 0;
+
+    size = GET_SIZE(HDRP(bp));
+    if (size <= lo || size >= hi)
+        printf("### Tree node %p of size %lu out of order ###\n", bp, size);
+    if (PREV_BLKP(bp))
+        printf("### Tree node %p has a prev link ###\n", bp);
+
+    for (cp = bp; cp != NULL; cp = NEXT_BLKP(cp)) {
+        checkfreeblock(cp, i, verbose);
+        if (GET_SIZE(HDRP(cp)) != size)
+            printf("### Block %p chained to node of size %lu ###\n", cp, size);
+        count++;
+    }
+    return count + checktree(LEFT_BLKP(bp), i, lo, size, verbose)
+                 + checktree(RIGHT_BLKP(bp), i, size, hi, verbose);
+}
+#endif
+
+/*
+ * checkfreelists - Check (and print) every size class. Returns the total
+ * number of blocks on the free lists.
+ */
+static int checkfreelists(int verbose) {
     char *bp;
-    // int i = 0;
+    int i, count = 0;
 
-    printf("Free (%p):\n", free_listp);
+    for (i = 0; i < NUM_CLASSES; i++) {
+        if (verbose && GETL(HEADP(i)))
+            printf("Free class %d (%p):\n", i, HEAD_BLKP(i));
+        if (!GETL(HEADP(i)) != !(class_map & (1u << i)))
+            printf("Error: class_map bit %d does not match class %d\n", i, i);
 
-    for (bp = free_listp; GET_SIZE(HDRP(bp)) > QSIZE; bp = NEXT_BLKP(bp)) {
-        printf("%p\n", bp);
-        checkblock(bp);
-        printfreeblock(bp);
-        // ++i;
-        // if (i > 100) {
-        //     printf("######### printfreelist traps ############\n");
-        //     break; 
-        // }
+#ifdef BEST_FIT
+        if (i >= TREE_CLASS) {
+            count += checktree(HEAD_BLKP(i), i, 0, (size_t)-1, verbose);
+            continue;
+        }
+#endif
+        for (bp = HEAD_BLKP(i); bp != NULL; bp = NEXT_BLKP(bp)) {
+            checkfreeblock(bp, i, verbose);
+            count++;
+        }
     }
-    printfreeblock(bp);
+    return count;
 }
 
-/* 
- * checkheap - Minimal check of the heap for consistency 
+#if SLAB
+/*
+ * checkslabs - Check every slab with free objects against its free bitmap
+ * and the page map. Returns the number of such slabs.
+ */
+static int checkslabs(int verbose) {
+    char *s;
+    unsigned int bits;
+    int c, i, n, nfree, count = 0;
+
+    for (c = 0; c < SLAB_CLASSES; c++) {
+        for (s = UNLINK(GETL(SLAB_HEADP(c))); s != NULL;
+             s = UNLINK(GETL(SLAB_NEXTP(s)))) {
+            if (verbose)
+                printf("%p: slab [%3u:%3u free]\n", s, GET(SLAB_OBJSIZEP(s)),
+                       GET(SLAB_NFREEP(s)));
+            count++;
+
+            if (!is_slab(s) || SLAB_BASE(s) != s)
+                printf("### Slab %p not in the page map ###\n", s);
+            if (GET(SLAB_OBJSIZEP(s)) != (c + 1) * DSIZE)
+                printf("### Slab %p of size %u in class %d ###\n",
+                       s, GET(SLAB_OBJSIZEP(s)), c);
+            if (UNLINK(GETL(SLAB_NEXTP(s))) &&
+                UNLINK(GETL(SLAB_PREVP(UNLINK(GETL(SLAB_NEXTP(s)))))) != s)
+                printf("### Broken prev link after slab %p ###\n", s);
+
+            n = SLAB_OBJS((c + 1) * DSIZE);
+            for (i = 0, nfree = 0; i < SLAB_BITWORDS; i++, n -= 32) {
+                bits = GET(SLAB_BITSP(s) + i * WSIZE);
+                nfree += __builtin_popcount(bits);
+                if (n < 32 && (n <= 0 ? bits : bits >> n))
+                    printf("### Slab %p has free bits past its end ###\n", s);
+            }
+            if (nfree == 0 || nfree != (int)GET(SLAB_NFREEP(s)))
+                printf("### Slab %p counts %u free objects, bitmap has %d ###\n",
+                       s, GET(SLAB_NFREEP(s)), nfree);
+        }
+    }
+    return count;
+}
+#endif
+
+#if DEFER_COALESCE
+/*
+ * checkquick - Check that every block on a quick list is an allocated
+ * heap block of the list's size, and that quick_count adds up.
+ */
+static void checkquick(int verbose) {
+    char *bp;
+    size_t size;
+    int count = 0;
+
+    for (size = DSIZE; size <= QUICK_LIMIT; size += DSIZE) {
+        for (bp = UNLINK(GETL(QUICK_HEADP(size))); bp; bp = NEXT_BLKP(bp)) {
+            if (verbose)
+                printf("%p: quick [%zu]\n", bp, size);
+            count++;
+            if (!GET_ALLOC(HDRP(bp)) || GET_SIZE(HDRP(bp)) != size)
+                printf("### Block %p on the quick list of size %zu ###\n",
+                       bp, size);
+        }
+    }
+    if (count != quick_count)
+        printf("### %d blocks on the quick lists, quick_count is %d ###\n",
+               count, quick_count);
+}
+#endif
+
+/*
+ * checkheap - Minimal check of the heap for consistency
  */
 void checkheap(int verbose) {
     char *bp = heap_listp;
-    int prevfree = 0, currentFree = 0;
+    int prevfree = 0, currentFree = 0, heapfree = 0;
 
     if (verbose)
         printf("Heap (%p):\n", heap_listp);
 
     // Check (and print) prologue block
-    if ((GET_SIZE(HDRP(heap_listp)) != QSIZE) || !GET_ALLOC(HDRP(heap_listp))) {
+    if ((GET_SIZE(HDRP(heap_listp)) != DSIZE) || !GET_ALLOC(HDRP(heap_listp))) {
         printf("Bad prologue header: \n");
         printblock(bp);
         checkblock(heap_listp);
     }
 
     // 1. Check and print all blocks on the heap
-    // 2. Check of continuous free blocks
-    // 3. Check all free blocks are in the free list
+    // 2. Check of continuous free blocks and of the PREV_ALLOC bits
+    // 3. Count free blocks, to compare against the free lists
     for (bp = heap_listp; GET_SIZE(HDRP(bp)) > 0; bp = SUCC_BLKP(bp)) {
         if (verbose)
             printblock(bp);
         checkblock(bp);
 
-        currentFree = !GET_ALLOC(HDRP(bp));
+        if (bp != heap_listp && (!GET_PREV_ALLOC(HDRP(bp))) != prevfree) {
+            printf("### Wrong PREV_ALLOC bit ### \n");
+            printblock(bp);
+        }
 
-        char *free_bp;
-        if (currentFree) {
-            int found = 0;
-            for (free_bp = free_listp; GET_SIZE(HDRP(free_bp)) > QSIZE; free_bp = NEXT_BLKP(free_bp)) {
-                if (bp == free_bp) {
-                    found = 1;
-                    break;
-                }
-            }
+        currentFree = !GET_ALLOC(HDRP(bp));
+        heapfree += currentFree;
 
-            if (!found) {
-                printf("### Free block not in free list ### \n");
-            }
+#if SLAB
+        // Only a slab's own block may start in a slab page
+        if (is_slab(bp) && (currentFree || SLAB_BASE(bp) != bp)) {
+            printf("### Block in a slab page ### \n");
+            printblock(bp);
         }
+#endif
 
         // Check continuous free blocks
         if (currentFree && prevfree) {
-            printblock("### Continuous free blocks! ### \n");
+            printf("### Continuous free blocks! ### \n");
             printblock(bp);
         }
         prevfree = currentFree;
@@ -725,11 +1847,23 @@ void checkheap(int verbose) {
         printblock(bp);
 
     // Check (and print) epilogue block
-    if ((GET_SIZE(HDRP(bp)) != 0) || !(GET_ALLOC(HDRP(bp)))) {
+    if ((GET_SIZE(HDRP(bp)) != 0) || !(GET_ALLOC(HDRP(bp))) ||
+        (!GET_PREV_ALLOC(HDRP(bp))) != prevfree) {
         printf("Bad epilogue header: \n");
         printblock(bp);
     }
 
-    printfreelist();
+    // 4. Every free block is on exactly one free list
+    if (checkfreelists(verbose) != heapfree)
+        printf("### Free block count mismatch between heap and free lists ###\n");
+
+#if SLAB
+    // 5. Slabs with free objects agree with their bitmaps
+    checkslabs(verbose);
+#endif
+#if DEFER_COALESCE
+    // 6. Quick-list blocks are allocated blocks of their list's size
+    checkquick(verbose);
+#endif
     printf("-----------\n");
 }
@@ -0,0 +1,814 @@
+/*
+ * mm_mt.c
+ *
+ * A thread-safe allocator for multi-threaded programs, built from several
+ * copies of the explicit-list heap of mm.c.
+ *
+ * Arenas:
+ * Each arena is an independent heap with its own lock. Blocks use the
+ * mm.c format (one header word while allocated, a footer and two links
+ * while free, PREV_ALLOC bit, segregated first-fit lists), except that
+ * links are plain pointers. Every arena owns an ARENA_SIZE-aligned slice
+ * of one reserved region, so the arena of any block follows from its
+ * address. Threads are assigned to arenas round-robin, and a thread
+ * allocates from its own arena, so threads only contend when there are
+ * more of them than arenas.
+ *
+ * Thread caches:
+ * Each thread keeps a cache of blocks of up to TCACHE_MAX bytes that it
+ * freed recently, one LIFO bin per block size. The blocks stay marked
+ * allocated in their heap, and mt_malloc/mt_free serve them without any
+ * lock. When a bin fills up, its older half is returned.
+ *
+ * Batched frees:
+ * Small blocks leaving a cache are not freed one lock at a time: they are
+ * queued per arena and returned BATCH at a time under a single lock. This
+ * also covers "remote" frees of blocks that another thread's arena owns,
+ * as in a producer/consumer pipeline. Large blocks are freed right away.
+ * A thread's cache and queues are flushed when it exits.
+ *
+ * Mapped blocks:
+ * Requests of MT_MMAP_THRESHOLD bytes or more get a mapping of their own,
+ * which mt_free unmaps and mt_realloc resizes with mremap, as in mm.c. No
+ * arena block has size 0, so a zero-size header marks a mapped block.
+ * Smaller requests are mapped too once every arena's slice is used up,
+ * so a program can hold more than narenas * ARENA_SIZE bytes.
+ *
+ * Payloads are MT_ALIGN-aligned: 8 bytes by default, as in mm.c. The
+ * LD_PRELOAD library (mm_preload.c) builds with MT_ALIGN=16, which is what
+ * glibc promises. mt_memalign serves larger alignments, and fork() takes
+ * every arena lock first so the child never inherits a held lock.
+ */
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "mm_mt.h"
+
+#define WSIZE 4
+#define DSIZE 8
+#define PSIZE ((int)sizeof(char *)) /* Size of a free-list link */
+#define CHUNKSIZE (1 << 16)
+#define MT_LINE 64
+
+/* Payload alignment: a power of two, at least DSIZE */
+#ifndef MT_ALIGN
+#define MT_ALIGN DSIZE
+#endif
+
+/* A free block holds a header, a footer and two links */
+#define MIN_BLOCKSIZE ((2 * WSIZE + 2 * PSIZE + MT_ALIGN - 1) / MT_ALIGN * MT_ALIGN)
+
+/* Mapped blocks: the mapping's length and the payload's offset into it
+ * sit just below the zero-size header. */
+#define MT_MMAP_THRESHOLD (1 << 17)
+#define MAP_HDRSIZE (MT_ALIGN > 2 * DSIZE ? MT_ALIGN : 2 * DSIZE)
+#define IS_MAPPED(bp) (GET_SIZE(HDRP(bp)) == 0)
+#define MAP_LEN(bp) (*(size_t *)((char *)(bp) - 2 * DSIZE))
+#define MAP_BASE(bp) ((char *)(bp) - GET((char *)(bp) - DSIZE))
+
+/* Address space reserved for each arena */
+#define ARENA_SIZE ((size_t)1 << (sizeof(char *) == 8 ? 28 : 24))
+
+/* Segregated free lists: one class per multiple of 8 up to SMALL_LIMIT,
+ * then one class per power of two. */
+#define NUM_CLASSES 24
+#define SMALL_LIMIT 128
+
+#define TCACHE_MAX 256                    /* Largest cached block size */
+#define TCACHE_BINS (TCACHE_MAX / DSIZE + 1)
+#define TCACHE_COUNT 32                   /* Blocks per bin */
+#define BATCH 32                          /* Blocks returned per lock */
+
+#define MAX(x, y) ((x) > (y) ? (x) : (y))
+
+/* Pack a size and allocated bit into a word */
+#define PACK(size, alloc) ((size) | (alloc))
+
+/* Read and write a word at address p. The owner of an allocated block
+ * reads its header without a lock while a neighbour may be updating the
+ * PREV_ALLOC bit under the arena lock, so words are accessed atomically
+ * (plain loads and stores on x86). */
+#define GET(p) __atomic_load_n((unsigned int *)(p), __ATOMIC_RELAXED)
+#define PUT(p, val) __atomic_store_n((unsigned int *)(p), (val), __ATOMIC_RELAXED)
+
+/* Read the size or allocated fields from (a header/footer) at address p */
+#define GET_SIZE(p) (GET(p) & ~0x7)
+#define GET_ALLOC(p) (GET(p) & 0x1)
+
+/* Set in a header when the block before it on the heap is allocated */
+#define PREV_ALLOC 0x2
+#define GET_PREV_ALLOC(p) (GET(p) & PREV_ALLOC)
+#define SET_PREV_ALLOC(p) PUT(p, GET(p) | PREV_ALLOC)
+#define CLR_PREV_ALLOC(p) PUT(p, GET(p) & ~PREV_ALLOC)
+
+/* Given block ptr bp, compute address of its header and footer */
+#define HDRP(bp) ((char *)(bp)-WSIZE)
+#define FTRP(bp) ((char *)(bp) + GET_SIZE(HDRP(bp)) - DSIZE)
+
+/* Given block ptr bp, compute the predecessor (if free) and successor */
+#define PRED_BLKP(bp) ((char *)(bp) - GET_SIZE(((char *)(bp)-DSIZE)))
+#define SUCC_BLKP(bp) ((char *)(bp) + GET_SIZE(((char *)(bp)-WSIZE)))
+
+/* Free-list links of a free block. NEXT also links blocks in a thread
+ * cache or batch, which are still marked allocated. */
+#define NEXT(bp) (*(char **)(bp))
+#define PREV(bp) (*(char **)((char *)(bp) + PSIZE))
+
+typedef struct {
+    pthread_mutex_t lock;
+    char *lo;                  /* Start of this arena's slice */
+    char *brk;                 /* Current end of its heap */
+    char *lists[NUM_CLASSES];  /* Segregated free lists */
+} __attribute__((aligned(MT_LINE))) arena_t;
+
+typedef struct {
+    arena_t *arena;                  /* Arena this thread allocates from */
+    char *bins[TCACHE_BINS];         /* Cached blocks, by size / DSIZE */
+    int counts[TCACHE_BINS];
+    char *batch[MT_MAX_ARENAS];      /* Blocks to return, per arena */
+    int nbatch[MT_MAX_ARENAS];
+} tcache_t;
+
+static arena_t arenas[MT_MAX_ARENAS];
+static int narenas;
+static int use_cache;
+static char *region;           /* narenas * ARENA_SIZE, ARENA_SIZE aligned */
+static int next_arena;         /* Round-robin assignment of threads */
+
+static pthread_mutex_t init_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t tcache_key;
+static __thread tcache_t *tcache;
+
+#define ARENA_OF(bp) (&arenas[((char *)(bp) - region) / ARENA_SIZE])
+
+/* Function prototypes for internal helper routines */
+static size_t adjust_size(size_t size);
+static int size_class(size_t size);
+static void insert_free_block(arena_t *a, char *bp);
+static void remove_free_block(arena_t *a, char *bp);
+static void mark_free(char *bp, size_t size);
+static char *coalesce(arena_t *a, char *bp);
+static char *extend_arena(arena_t *a, size_t size);
+static void place(arena_t *a, char *bp, size_t asize);
+static char *arena_malloc(arena_t *a, size_t asize);
+static void arena_free(arena_t *a, char *bp);
+static char *arena_memalign(arena_t *a, size_t align, size_t asize);
+static char *map_malloc(size_t size, size_t align);
+static char *map_realloc(char *bp, size_t size);
+static tcache_t *get_tcache(void);
+static void tcache_release(tcache_t *t, char *bp);
+static void tcache_flush_batch(tcache_t *t, int i);
+static void tcache_destroy(void *vargp);
+static void mt_prefork(void);
+static void mt_postfork(void);
+
+/*
+ * mt_init - Set up narenas arenas (1 to MT_MAX_ARENAS, 0 for one per
+ * CPU), with or without thread caches. Returns 0, or -1 if the address
+ * space cannot be reserved.
+ */
+int mt_init(int narenas_req, int use_cache_req) {
+    char *p, *base;
+    size_t len;
+    int i;
+
+    if (narenas_req <= 0)
+        narenas_req = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (narenas_req < 1)
+        narenas_req = 1;
+    if (narenas_req > MT_MAX_ARENAS)
+        narenas_req = MT_MAX_ARENAS;
+
+    /* Reserve one extra slice so the arenas can be aligned */
+    len = (narenas_req + 1) * ARENA_SIZE;
+    p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (p == MAP_FAILED)
+        return -1;
+    base = (char *)(((uintptr_t)p + ARENA_SIZE - 1) & ~(ARENA_SIZE - 1));
+    if (base > p)
+        munmap(p, base - p);
+    munmap(base + narenas_req * ARENA_SIZE,
+           p + len - (base + narenas_req * ARENA_SIZE));
+
+    for (i = 0; i < narenas_req; i++) {
+        arena_t *a = &arenas[i];
+
+        pthread_mutex_init(&a->lock, NULL);
+        memset(a->lists, 0, sizeof(a->lists));
+        a->lo = base + i * ARENA_SIZE;
+
+        /* Same prologue and epilogue as mm.c */
+        PUT(a->lo, 0);                                 /* Alignment padding */
+        PUT(a->lo + (1 * WSIZE), PACK(DSIZE, 1));      /* Prologue header */
+        PUT(a->lo + (2 * WSIZE), PACK(DSIZE, 1));      /* Prologue footer */
+        PUT(a->lo + (3 * WSIZE), PACK(0, PREV_ALLOC | 1)); /* Epilogue header */
+        a->brk = a->lo + 4 * WSIZE;
+    }
+    narenas = narenas_req;
+    use_cache = use_cache_req;
+    next_arena = 0;
+
+    /* Publish last: get_tcache checks region without the init lock */
+    __atomic_store_n(&region, base, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/*
+ * mt_deinit - Release every arena. No other thread may be using the
+ * allocator, and blocks cached by threads that are still alive are lost.
+ */
+void mt_deinit(void) {
+    int i;
+
+    if (region == NULL)
+        return;
+    for (i = 0; i < narenas; i++)
+        pthread_mutex_destroy(&arenas[i].lock);
+    munmap(region, narenas * ARENA_SIZE);
+    region = NULL;
+    tcache = NULL;
+    pthread_setspecific(tcache_key, NULL);
+}
+
+/*
+ * mt_malloc - Serve small requests from the thread cache, everything else
+ * from the thread's arena (or any arena with room if that one is full,
+ * or a mapping of its own if they all are).
+ */
+void *mt_malloc(size_t size) {
+    tcache_t *t;
+    size_t asize;
+    char *bp;
+    int i, b;
+
+    if (size == 0)
+        return NULL;
+    if (size >= MT_MMAP_THRESHOLD)
+        return map_malloc(size, MT_ALIGN);
+
+    t = get_tcache();
+    if (t == NULL)
+        return NULL;
+    asize = adjust_size(size);
+
+    b = asize / DSIZE;
+    if (use_cache && asize <= TCACHE_MAX && (bp = t->bins[b]) != NULL) {
+        t->bins[b] = NEXT(bp);
+        t->counts[b]--;
+        return bp;
+    }
+
+    pthread_mutex_lock(&t->arena->lock);
+    bp = arena_malloc(t->arena, asize);
+    pthread_mutex_unlock(&t->arena->lock);
+
+    for (i = 0; bp == NULL && i < narenas; i++) {
+        if (&arenas[i] == t->arena)
+            continue;
+        pthread_mutex_lock(&arenas[i].lock);
+        bp = arena_malloc(&arenas[i], asize);
+        pthread_mutex_unlock(&arenas[i].lock);
+    }
+    return bp != NULL ? bp : map_malloc(size, MT_ALIGN);
+}
+
+/*
+ * mt_free - Cache small blocks, returning the older half of a full bin in
+ * batches; free large blocks under their arena's lock.
+ */
+void mt_free(void *ptr) {
+    tcache_t *t;
+    arena_t *a;
+    char *bp = ptr, *cut;
+    size_t size;
+    int b, i;
+
+    if (bp == NULL)
+        return;
+
+    size = GET_SIZE(HDRP(bp));
+    if (size == 0) {
+        munmap(MAP_BASE(bp), MAP_LEN(bp));
+        return;
+    }
+    if (use_cache && size <= TCACHE_MAX && (t = get_tcache()) != NULL) {
+        b = size / DSIZE;
+        if (t->counts[b] == TCACHE_COUNT) {
+            /* Keep the newest half, return the rest */
+            for (cut = t->bins[b], i = 1; i < TCACHE_COUNT / 2; i++)
+                cut = NEXT(cut);
+            while (NEXT(cut) != NULL) {
+                char *old = NEXT(cut);
+
+                NEXT(cut) = NEXT(old);
+                tcache_release(t, old);
+            }
+            t->counts[b] = TCACHE_COUNT / 2;
+        }
+        NEXT(bp) = t->bins[b];
+        t->bins[b] = bp;
+        t->counts[b]++;
+        return;
+    }
+
+    a = ARENA_OF(bp);
+    pthread_mutex_lock(&a->lock);
+    arena_free(a, bp);
+    pthread_mutex_unlock(&a->lock);
+}
+
+/*
+ * mt_realloc - Grow in place into a free successor when possible,
+ * otherwise move the block.
+ */
+void *mt_realloc(void *ptr, size_t size) {
+    arena_t *a;
+    size_t asize, csize, total;
+    char *bp = ptr, *next, *rest;
+    void *newptr;
+
+    if (ptr == NULL)
+        return mt_malloc(size);
+    if (size == 0) {
+        mt_free(ptr);
+        return NULL;
+    }
+    if (size > (size_t)-1 / 2)
+        return NULL;
+
+    if (IS_MAPPED(bp)) {
+        if (size >= MT_MMAP_THRESHOLD)
+            return map_realloc(bp, size);
+        if ((newptr = mt_malloc(size)) == NULL)
+            return NULL;
+        memcpy(newptr, ptr, size);
+        mt_free(ptr);
+        return newptr;
+    }
+
+    asize = adjust_size(size);
+    csize = GET_SIZE(HDRP(bp));
+    if (asize <= csize)
+        return ptr;
+
+    a = ARENA_OF(bp);
+    pthread_mutex_lock(&a->lock);
+    next = SUCC_BLKP(bp);
+    total = csize + (GET_ALLOC(HDRP(next)) ? 0 : GET_SIZE(HDRP(next)));
+    if (total >= asize) {
+        remove_free_block(a, next);
+        if (total - asize >= MIN_BLOCKSIZE) {
+            PUT(HDRP(bp), PACK(asize, GET_PREV_ALLOC(HDRP(bp)) | 1));
+            rest = SUCC_BLKP(bp);
+            PUT(HDRP(rest), PACK(total - asize, PREV_ALLOC));
+            PUT(FTRP(rest), PACK(total - asize, 0));
+            insert_free_block(a, rest);
+        } else {
+            PUT(HDRP(bp), PACK(total, GET_PREV_ALLOC(HDRP(bp)) | 1));
+            SET_PREV_ALLOC(HDRP(SUCC_BLKP(bp)));
+        }
+        pthread_mutex_unlock(&a->lock);
+        return ptr;
+    }
+    pthread_mutex_unlock(&a->lock);
+
+    if ((newptr = mt_malloc(size)) == NULL)
+        return NULL;
+    memcpy(newptr, ptr, csize - WSIZE);
+    mt_free(ptr);
+    return newptr;
+}
+
+/*
+ * mt_calloc - Allocate a zeroed array
+ */
+void *mt_calloc(size_t nmemb, size_t size) {
+    void *ptr;
+
+    if (size != 0 && nmemb > (size_t)-1 / size)
+        return NULL;
+    /* Fresh mappings are already zero */
+    if ((ptr = mt_malloc(nmemb * size)) != NULL && !IS_MAPPED(ptr))
+        memset(ptr, 0, nmemb * size);
+    return ptr;
+}
+
+/*
+ * mt_memalign - Allocate size bytes aligned to align, a power of two.
+ */
+void *mt_memalign(size_t align, size_t size) {
+    tcache_t *t;
+    char *bp;
+
+    if (align <= MT_ALIGN)
+        return mt_malloc(size);
+    if (size == 0)
+        return NULL;
+    if (size >= MT_MMAP_THRESHOLD || align >= MT_MMAP_THRESHOLD)
+        return map_malloc(size, align);
+
+    if ((t = get_tcache()) == NULL)
+        return NULL;
+    pthread_mutex_lock(&t->arena->lock);
+    bp = arena_memalign(t->arena, align, adjust_size(size));
+    pthread_mutex_unlock(&t->arena->lock);
+    return bp != NULL ? bp : map_malloc(size, align);
+}
+
+/*
+ * mt_usable_size - Payload bytes available in allocated block ptr, which
+ * may exceed the size it was requested with.
+ */
+size_t mt_usable_size(void *ptr) {
+    char *bp = ptr;
+
+    if (bp == NULL)
+        return 0;
+    if (IS_MAPPED(bp))
+        return MAP_BASE(bp) + MAP_LEN(bp) - bp;
+    return GET_SIZE(HDRP(bp)) - WSIZE;
+}
+
+/*
+ * adjust_size - Block size for a payload of size bytes, including
+ * overhead and alignment.
+ */
+static size_t adjust_size(size_t size) {
+    return MAX(MIN_BLOCKSIZE,
+               MT_ALIGN * ((size + WSIZE + (MT_ALIGN - 1)) / MT_ALIGN));
+}
+
+/*
+ * size_class - Map a block size to the index of its free list.
+ */
+static int size_class(size_t size) {
+    int i;
+
+    if (size <= SMALL_LIMIT)
+        return (size - MIN_BLOCKSIZE) / DSIZE;
+
+    /* (SMALL_LIMIT, 2 * SMALL_LIMIT] -> first power-of-two class, ... */
+    i = (SMALL_LIMIT - MIN_BLOCKSIZE) / DSIZE + 1;
+    for (size = (size - 1) / SMALL_LIMIT; size > 1 && i < NUM_CLASSES - 1;
+         size >>= 1)
+        i++;
+    return i;
+}
+
+/*
+ * insert_free_block - Push a free block on the front of its size class.
+ */
+static void insert_free_block(arena_t *a, char *bp) {
+    int i = size_class(GET_SIZE(HDRP(bp)));
+
+    NEXT(bp) = a->lists[i];
+    PREV(bp) = NULL;
+    if (a->lists[i])
+        PREV(a->lists[i]) = bp;
+    a->lists[i] = bp;
+}
+
+/*
+ * remove_free_block - Unlink a free block from its size class. Must be
+ * called before the block's size changes.
+ */
+static void remove_free_block(arena_t *a, char *bp) {
+    if (PREV(bp))
+        NEXT(PREV(bp)) = NEXT(bp);
+    else
+        a->lists[size_class(GET_SIZE(HDRP(bp)))] = NEXT(bp);
+    if (NEXT(bp))
+        PREV(NEXT(bp)) = PREV(bp);
+}
+
+/*
+ * mark_free - Write the header and footer of free block bp of the given
+ * size, keeping the PREV_ALLOC bit of its header.
+ */
+static void mark_free(char *bp, size_t size) {
+    PUT(HDRP(bp), PACK(size, GET_PREV_ALLOC(HDRP(bp))));
+    PUT(FTRP(bp), PACK(size, 0));
+}
+
+/*
+ * coalesce - Merge free block bp with its free neighbours and put the
+ * result on a free list.
+ */
+static char *coalesce(arena_t *a, char *bp) {
+    size_t prev_alloc = GET_PREV_ALLOC(HDRP(bp));
+    size_t next_alloc = GET_ALLOC(HDRP(SUCC_BLKP(bp)));
+    size_t size = GET_SIZE(HDRP(bp));
+
+    if (!next_alloc) {
+        remove_free_block(a, SUCC_BLKP(bp));
+        size += GET_SIZE(HDRP(SUCC_BLKP(bp)));
+    }
+    if (!prev_alloc) {
+        remove_free_block(a, PRED_BLKP(bp));
+        size += GET_SIZE(HDRP(PRED_BLKP(bp)));
+        bp = PRED_BLKP(bp);
+    }
+    mark_free(bp, size);
+
+    /* The block after a free block never has PREV_ALLOC set */
+    CLR_PREV_ALLOC(HDRP(SUCC_BLKP(bp)));
+    insert_free_block(a, bp);
+    return bp;
+}
+
+/*
+ * extend_arena - Grow the arena's heap by size bytes, or return NULL if
+ * its slice is used up.
+ */
+static char *extend_arena(arena_t *a, size_t size) {
+    char *bp = a->brk;
+
+    if (size > (size_t)(a->lo + ARENA_SIZE - a->brk))
+        return NULL;
+    a->brk += size;
+
+    /* The old epilogue header becomes the new block's header */
+    mark_free(bp, size);
+    PUT(HDRP(SUCC_BLKP(bp)), PACK(0, 1)); /* New epilogue header */
+    return coalesce(a, bp);
+}
+
+/*
+ * place - Allocate asize bytes at the start of free block bp, splitting
+ * off the remainder if it can form a block.
+ */
+static void place(arena_t *a, char *bp, size_t asize) {
+    size_t csize = GET_SIZE(HDRP(bp));
+    unsigned int prev_alloc = GET_PREV_ALLOC(HDRP(bp));
+    char *rest;
+
+    remove_free_block(a, bp);
+
+    if ((csize - asize) >= MIN_BLOCKSIZE) {
+        PUT(HDRP(bp), PACK(asize, prev_alloc | 1));
+        rest = SUCC_BLKP(bp);
+        PUT(HDRP(rest), PACK(csize - asize, PREV_ALLOC));
+        PUT(FTRP(rest), PACK(csize - asize, 0));
+        insert_free_block(a, rest);
+    } else {
+        PUT(HDRP(bp), PACK(csize, prev_alloc | 1));
+        SET_PREV_ALLOC(HDRP(SUCC_BLKP(bp)));
+    }
+}
+
+/*
+ * arena_malloc - First fit over the request's size class and up, then
+ * extend the heap. Called with the arena locked.
+ */
+static char *arena_malloc(arena_t *a, size_t asize) {
+    char *bp;
+    int i;
+
+    for (i = size_class(asize); i < NUM_CLASSES; i++) {
+        for (bp = a->lists[i]; bp != NULL; bp = NEXT(bp)) {
+            if (asize <= GET_SIZE(HDRP(bp))) {
+                place(a, bp, asize);
+                return bp;
+            }
+        }
+    }
+
+    if ((bp = extend_arena(a, MAX(asize, CHUNKSIZE))) == NULL)
+        return NULL;
+    place(a, bp, asize);
+    return bp;
+}
+
+/*
+ * arena_free - Free an allocated block. Called with the arena locked.
+ */
+static void arena_free(arena_t *a, char *bp) {
+    mark_free(bp, GET_SIZE(HDRP(bp)));
+    coalesce(a, bp);
+}
+
+/*
+ * arena_memalign - Carve a block of asize bytes with an align-aligned
+ * payload out of an oversized one, freeing the slack on either side.
+ * Called with the arena locked.
+ */
+static char *arena_memalign(arena_t *a, size_t align, size_t asize) {
+    char *bp, *abp, *rest;
+    size_t csize;
+
+    if ((bp = arena_malloc(a, asize + align + MIN_BLOCKSIZE)) == NULL)
+        return NULL;
+
+    /* The slack in front must be empty or big enough to be a block */
+    abp = (char *)(((uintptr_t)bp + align - 1) & ~(uintptr_t)(align - 1));
+    if (abp != bp && abp - bp < MIN_BLOCKSIZE)
+        abp += align;
+    if (abp != bp) {
+        csize = GET_SIZE(HDRP(bp));
+        PUT(HDRP(bp), PACK(abp - bp, GET_PREV_ALLOC(HDRP(bp)) | 1));
+        PUT(HDRP(abp), PACK(csize - (abp - bp), PREV_ALLOC | 1));
+        arena_free(a, bp);
+    }
+
+    csize = GET_SIZE(HDRP(abp));
+    if (csize - asize >= MIN_BLOCKSIZE) {
+        PUT(HDRP(abp), PACK(asize, GET_PREV_ALLOC(HDRP(abp)) | 1));
+        rest = SUCC_BLKP(abp);
+        PUT(HDRP(rest), PACK(csize - asize, PREV_ALLOC | 1));
+        arena_free(a, rest);
+    }
+    return abp;
+}
+
+/*
+ * map_malloc - Give a block of size bytes a mapping of its own, with the
+ * payload aligned to align. The slack around it is unmapped again.
+ */
+static char *map_malloc(size_t size, size_t align) {
+    size_t pagesize = sysconf(_SC_PAGESIZE);
+    size_t len;
+    char *p, *bp, *base, *end;
+
+    if (size > (size_t)-1 / 2)
+        return NULL;
+    len = MAP_HDRSIZE + size + (align > MT_ALIGN ? align : 0);
+    len = (len + pagesize - 1) & ~(pagesize - 1);
+    p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+             -1, 0);
+    if (p == MAP_FAILED)
+        return NULL;
+
+    bp = (char *)(((uintptr_t)p + MAP_HDRSIZE + align - 1) &
+                  ~(uintptr_t)(align - 1));
+    base = (char *)((uintptr_t)(bp - MAP_HDRSIZE) & ~(pagesize - 1));
+    end = (char *)(((uintptr_t)bp + size + pagesize - 1) & ~(pagesize - 1));
+    if (base > p)
+        munmap(p, base - p);
+    if (end < p + len)
+        munmap(end, p + len - end);
+
+    MAP_LEN(bp) = end - base;
+    PUT(bp - DSIZE, bp - base);
+    PUT(HDRP(bp), PACK(0, 1));
+    return bp;
+}
+
+/*
+ * map_realloc - Resize a mapped block with mremap, which moves the pages
+ * instead of copying them.
+ */
+static char *map_realloc(char *bp, size_t size) {
+    size_t pagesize = sysconf(_SC_PAGESIZE);
+    size_t off = bp - MAP_BASE(bp), len;
+    char *base;
+
+    if (size > (size_t)-1 / 2)
+        return NULL;
+    len = (off + size + pagesize - 1) & ~(pagesize - 1);
+    if (len == MAP_LEN(bp))
+        return bp;
+    base = mremap(MAP_BASE(bp), MAP_LEN(bp), len, MREMAP_MAYMOVE);
+    if (base == MAP_FAILED)
+        return NULL;
+    MAP_LEN(base + off) = len;
+    return base + off;
+}
+
+/*
+ * get_tcache - The calling thread's cache, created on first use together
+ * with the thread's arena assignment (and mapped if that arena is full). Sets up the default arenas if
+ * mt_init was never called.
+ */
+static void make_key(void) {
+    pthread_key_create(&tcache_key, tcache_destroy);
+    pthread_atfork(mt_prefork, mt_postfork, mt_postfork);
+}
+
+static tcache_t *get_tcache(void) {
+    arena_t *a;
+    tcache_t *t;
+
+    if (tcache != NULL)
+        return tcache;
+
+    pthread_once(&key_once, make_key);
+    if (__atomic_load_n(&region, __ATOMIC_ACQUIRE) == NULL) {
+        pthread_mutex_lock(&init_lock);
+        if (region == NULL && mt_init(0, 1) < 0) {
+            pthread_mutex_unlock(&init_lock);
+            return NULL;
+        }
+        pthread_mutex_unlock(&init_lock);
+    }
+
+    /* The cache itself lives in the thread's arena */
+    a = &arenas[__atomic_fetch_add(&next_arena, 1, __ATOMIC_RELAXED) % narenas];
+    pthread_mutex_lock(&a->lock);
+    t = (tcache_t *)arena_malloc(a, adjust_size(sizeof(tcache_t)));
+    pthread_mutex_unlock(&a->lock);
+    if (t == NULL)
+        t = (tcache_t *)map_malloc(sizeof(tcache_t), MT_ALIGN);
+    if (t == NULL)
+        return NULL;
+
+    memset(t, 0, sizeof(tcache_t));
+    t->arena = a;
+    tcache = t;
+    pthread_setspecific(tcache_key, t);
+    return t;
+}
+
+/*
+ * tcache_release - Queue a small block for return to its arena, and
+ * return the queue once it holds BATCH blocks.
+ */
+static void tcache_release(tcache_t *t, char *bp) {
+    int i = ARENA_OF(bp) - arenas;
+
+    NEXT(bp) = t->batch[i];
+    t->batch[i] = bp;
+    if (++t->nbatch[i] == BATCH)
+        tcache_flush_batch(t, i);
+}
+
+/*
+ * tcache_flush_batch - Free every block queued for arena i under one lock.
+ */
+static void tcache_flush_batch(tcache_t *t, int i) {
+    char *bp, *next;
+
+    if (t->batch[i] == NULL)
+        return;
+
+    pthread_mutex_lock(&arenas[i].lock);
+    for (bp = t->batch[i]; bp != NULL; bp = next) {
+        next = NEXT(bp);
+        arena_free(&arenas[i], bp);
+    }
+    pthread_mutex_unlock(&arenas[i].lock);
+    t->batch[i] = NULL;
+    t->nbatch[i] = 0;
+}
+
+/*
+ * tcache_destroy - Thread exit: return every cached and queued block,
+ * then the cache itself.
+ */
+static void tcache_destroy(void *vargp) {
+    tcache_t *t = vargp;
+    arena_t *a = t->arena;
+    char *bp;
+    int b, i;
+
+    for (b = 0; b < TCACHE_BINS; b++) {
+        while ((bp = t->bins[b]) != NULL) {
+            t->bins[b] = NEXT(bp);
+            tcache_release(t, bp);
+        }
+    }
+    for (i = 0; i < narenas; i++)
+        tcache_flush_batch(t, i);
+
+    /* Freeing t overwrites t->arena with a free-list link */
+    tcache = NULL;
+    if (IS_MAPPED(t)) {
+        munmap(MAP_BASE(t), MAP_LEN(t));
+        return;
+    }
+    pthread_mutex_lock(&a->lock);
+    arena_free(a, (char *)t);
+    pthread_mutex_unlock(&a->lock);
+}
+
+/*
+ * mt_prefork - Take every lock before fork(), so that no other thread
+ * holds one when the address space is copied.
+ */
+static void mt_prefork(void) {
+    int i;
+
+    pthread_mutex_lock(&init_lock);
+    if (region != NULL)
+        for (i = 0; i < narenas; i++)
+            pthread_mutex_lock(&arenas[i].lock);
+}
+
+/*
+ * mt_postfork - Release the locks again, in the parent and in the child.
+ */
+static void mt_postfork(void) {
+    int i;
+
+    if (region != NULL)
+        for (i = 0; i < narenas; i++)
+            pthread_mutex_unlock(&arenas[i].lock);
+    pthread_mutex_unlock(&init_lock);
+}
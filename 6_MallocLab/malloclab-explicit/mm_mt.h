@@ -0,0 +1,21 @@
+#ifndef __MM_MT_H__
+#define __MM_MT_H__
+
+#include <stddef.h>
+
+#define MT_MAX_ARENAS 16
+
+/*
+ * Thread-safe allocator (mm_mt.c). mt_init is optional: the first call
+ * to mt_malloc sets up one arena per CPU with thread caches enabled.
+ */
+int mt_init(int narenas, int use_cache);
+void mt_deinit(void);
+void *mt_malloc(size_t size);
+void mt_free(void *ptr);
+void *mt_realloc(void *ptr, size_t size);
+void *mt_calloc(size_t nmemb, size_t size);
+void *mt_memalign(size_t align, size_t size);
+size_t mt_usable_size(void *ptr);
+
+#endif /* __MM_MT_H__ */
@@ -0,0 +1,102 @@
+/*
+ * mm_preload.c - Run real programs on the lab allocator
+ *
+ * Run-time interpositioning as in code_examples/link/interpose/mymalloc.c,
+ * except that nothing is forwarded to libc: every entry point of the C
+ * library's malloc API is served by mm_mt, the thread-safe version of
+ * the allocator in mm.c, over its own mmap-reserved arenas. glibc only
+ * supports replacing malloc when all of these are replaced together;
+ * otherwise one of them would hand a pointer from our heap to glibc's.
+ *
+ * Example:
+ *   linux> make libmm.so CFLAGS="-Wall -O2"    (drop -m32 for 64-bit programs)
+ *   linux> LD_PRELOAD=./libmm.so ./tsh
+ *
+ * Compare peak RSS and run time against glibc with
+ *   linux> /usr/bin/time -f "%e s %M KB" ./prog
+ *   linux> LD_PRELOAD=./libmm.so /usr/bin/time -f "%e s %M KB" ./prog
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "mm_mt.h"
+
+/* Power-of-two test for alignments */
+#define POW2(x) ((x) != 0 && ((x) & ((x)-1)) == 0)
+
+/* Set errno the way glibc does when an allocation fails */
+static void *check(void *ptr) {
+    if (ptr == NULL)
+        errno = ENOMEM;
+    return ptr;
+}
+
+/* malloc(0) returns a unique pointer, as in glibc, since many programs
+ * treat NULL as out of memory */
+void *malloc(size_t size) {
+    return check(mt_malloc(size ? size : 1));
+}
+
+void free(void *ptr) {
+    mt_free(ptr);
+}
+
+void *calloc(size_t nmemb, size_t size) {
+    if (nmemb == 0 || size == 0)
+        nmemb = size = 1;
+    return check(mt_calloc(nmemb, size));
+}
+
+/* realloc(ptr, 0) frees ptr and returns NULL, as in glibc */
+void *realloc(void *ptr, size_t size) {
+    void *newptr = mt_realloc(ptr, ptr ? size : (size ? size : 1));
+
+    return (newptr == NULL && size != 0) ? check(NULL) : newptr;
+}
+
+void *reallocarray(void *ptr, size_t nmemb, size_t size) {
+    if (size != 0 && nmemb > SIZE_MAX / size)
+        return check(NULL);
+    return realloc(ptr, nmemb * size);
+}
+
+int posix_memalign(void **memptr, size_t align, size_t size) {
+    void *ptr;
+
+    if (!POW2(align) || align % sizeof(void *) != 0)
+        return EINVAL;
+    if ((ptr = mt_memalign(align, size ? size : 1)) == NULL)
+        return ENOMEM;
+    *memptr = ptr;
+    return 0;
+}
+
+void *memalign(size_t align, size_t size) {
+    if (!POW2(align)) {
+        errno = EINVAL;
+        return NULL;
+    }
+    return check(mt_memalign(align, size ? size : 1));
+}
+
+void *aligned_alloc(size_t align, size_t size) {
+    return memalign(align, size);
+}
+
+void *valloc(size_t size) {
+    return memalign(sysconf(_SC_PAGESIZE), size);
+}
+
+void *pvalloc(size_t size) {
+    size_t pagesize = sysconf(_SC_PAGESIZE);
+
+    if (size > SIZE_MAX - pagesize)
+        return check(NULL);
+    return memalign(pagesize, (size + pagesize - 1) & ~(pagesize - 1));
+}
+
+size_t malloc_usable_size(void *ptr) {
+    return mt_usable_size(ptr);
+}
@@ -0,0 +1,400 @@
+/*
+ * mtbench.c - Multi-threaded allocator benchmark
+ *
+ * Each thread repeatedly picks a slot in a shared array, allocates a new
+ * block for it and frees the block that was there. A thread normally
+ * picks slots in its own part of the array; remote% of the time it picks
+ * any slot, freeing a block another thread allocated. Sizes are mostly
+ * 8-128 bytes with an occasional block of up to 4KB.
+ *
+ * Reports millions of malloc/free pairs per second for nthreads = 1, 2,
+ * 4, ... maxthreads and each allocator:
+ *   libc    - the C library's malloc
+ *   locked  - mm_mt with one arena and no thread caches (one global lock)
+ *   arenas  - mm_mt with one arena per CPU and no thread caches
+ *   cached  - mm_mt with arenas and thread caches
+ *
+ * With -f, mtbench instead replays a trace whose requests are tagged with
+ * thread ids (see tracefmt.h, or record one with mmtrace.so) on that many
+ * threads. A request waits until every earlier request on the same block
+ * has been done, whichever thread made it, so a block freed by another
+ * thread is still freed after its malloc. For each allocator it reports
+ * the aggregate throughput and each thread's request latencies; time
+ * spent waiting for other threads is left out of the latencies.
+ *
+ * With -s, mtbench checks that mm_mt keeps serving small blocks once its
+ * arenas are full: it holds megabytes MB of blocks of up to 4KB at once
+ * in a single arena, then checks and frees them. Ask for more than one
+ * arena's slice (256 MB on 64-bit, 16 MB on 32-bit) to test the fallback.
+ *
+ * Usage: mtbench <maxthreads> [ops_per_thread] [remote%]
+ *        mtbench -f <tracefile>
+ *        mtbench -s <megabytes>
+ */
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ftimer.h"
+#include "mm_mt.h"
+
+#define MAXTHREADS 32
+#define SLOTS_PER_THREAD 1024
+
+enum { LIBC, LOCKED, ARENAS, CACHED, NKINDS };
+static const char *kind_name[] = {"libc", "locked", "arenas", "cached"};
+
+static void *(*malloc_fn)(size_t);
+static void *(*realloc_fn)(void *, size_t);
+static void (*free_fn)(void *);
+
+/* Global shared variables */
+static void *slots[MAXTHREADS * SLOTS_PER_THREAD];
+static int nthreads;
+static long ops;
+static int remote;
+
+/* One request of a replayed trace */
+typedef struct {
+    char type;                 /* 'a', 'r' or 'f' */
+    int index;                 /* block id */
+    int size;
+    int want;                  /* Earlier requests on this block */
+} rop_t;
+
+/* The requests of one replay thread, and their latencies */
+typedef struct {
+    rop_t *ops;
+    long n, cap;
+    unsigned *lat;             /* ns per request */
+} rthread_t;
+
+static rthread_t rthreads[MAXTHREADS];
+static int num_ids;
+static void **blocks;          /* Block for each id */
+static int *done;              /* Requests done on each id */
+
+static void set_kind(int kind);
+static void *bench_thread(void *vargp);
+static void run_threads(void *argp);
+static void read_replay(char *filename);
+static void *replay_thread(void *vargp);
+static void run_replay(void *argp);
+static void replay(char *filename);
+static void fill(long megabytes);
+
+int main(int argc, char **argv) {
+    int kind, maxthreads, i;
+    double secs;
+
+    if (argc == 3 && strcmp(argv[1], "-f") == 0) {
+        replay(argv[2]);
+        exit(0);
+    }
+    if (argc == 3 && strcmp(argv[1], "-s") == 0) {
+        fill(atol(argv[2]));
+        exit(0);
+    }
+    if (argc < 2 || argc > 4) {
+        printf("Usage: %s <maxthreads> [ops_per_thread] [remote%%]\n", argv[0]);
+        printf("       %s -f <tracefile>\n", argv[0]);
+        printf("       %s -s <megabytes>\n", argv[0]);
+        exit(0);
+    }
+    maxthreads = atoi(argv[1]);
+    ops = (argc > 2) ? atol(argv[2]) : 1000000;
+    remote = (argc > 3) ? atoi(argv[3]) : 10;
+    if (maxthreads < 1 || maxthreads > MAXTHREADS || ops < 1 || remote < 0 ||
+        remote > 100) {
+        printf("Error: invalid arguments\n");
+        exit(0);
+    }
+
+    printf("%8s", "threads");
+    for (kind = 0; kind < NKINDS; kind++)
+        printf("%10s", kind_name[kind]);
+    printf("   (Mops/s, %d%% remote frees)\n", remote);
+
+    for (nthreads = 1; nthreads <= maxthreads; nthreads *= 2) {
+        printf("%8d", nthreads);
+        for (kind = 0; kind < NKINDS; kind++) {
+            set_kind(kind);
+            secs = ftimer_gettod(run_threads, NULL, 1);
+
+            /* Empty the slots so the next allocator starts clean */
+            for (i = 0; i < MAXTHREADS * SLOTS_PER_THREAD; i++) {
+                free_fn(slots[i]);
+                slots[i] = NULL;
+            }
+            if (kind != LIBC)
+                mt_deinit();
+
+            printf("%10.2f", nthreads * ops / secs / 1e6);
+            fflush(stdout);
+        }
+        printf("\n");
+    }
+    exit(0);
+}
+
+/* Point the allocator functions at one allocator */
+static void set_kind(int kind) {
+    if (kind == LIBC) {
+        malloc_fn = malloc;
+        realloc_fn = realloc;
+        free_fn = free;
+        return;
+    }
+    malloc_fn = mt_malloc;
+    realloc_fn = mt_realloc;
+    free_fn = mt_free;
+    if (mt_init(kind == LOCKED ? 1 : 0, kind == CACHED) < 0) {
+        printf("\nError: mt_init failed\n");
+        exit(1);
+    }
+}
+
+/* Start nthreads benchmark threads and wait for them */
+static void run_threads(void *argp) {
+    pthread_t tid[MAXTHREADS];
+    long myid[MAXTHREADS];
+    int i;
+
+    for (i = 0; i < nthreads; i++) {
+        myid[i] = i;
+        pthread_create(&tid[i], NULL, bench_thread, &myid[i]);
+    }
+    for (i = 0; i < nthreads; i++)
+        pthread_join(tid[i], NULL);
+}
+
+/* Thread routine: replace blocks in random slots */
+static void *bench_thread(void *vargp) {
+    long myid = *((long *)vargp);
+    unsigned int seed = myid + 1;
+    size_t size;
+    long i;
+    int r, s;
+    void *bp;
+
+    for (i = 0; i < ops; i++) {
+        r = rand_r(&seed);
+        if (r % 100 < remote)
+            s = rand_r(&seed) % (nthreads * SLOTS_PER_THREAD);
+        else
+            s = myid * SLOTS_PER_THREAD + rand_r(&seed) % SLOTS_PER_THREAD;
+        size = (r % 64 == 0) ? 256 + r % 3840 : 8 + r % 121;
+
+        if ((bp = malloc_fn(size)) == NULL) {
+            printf("\nError: out of memory\n");
+            exit(1);
+        }
+        memset(bp, (int)myid, 8);
+        free_fn(__atomic_exchange_n(&slots[s], bp, __ATOMIC_ACQ_REL));
+    }
+    return NULL;
+}
+
+/* Read a thread-tagged trace into per-thread request lists */
+static void read_replay(char *filename) {
+    FILE *fp;
+    char type[16];
+    int *count, header[4], tid = 0, i;
+    rthread_t *t;
+    rop_t *op;
+
+    if ((fp = fopen(filename, "r")) == NULL) {
+        perror(filename);
+        exit(1);
+    }
+    for (i = 0; i < 4; i++)
+        if (fscanf(fp, "%d", &header[i]) != 1) {
+            printf("Error: bad trace header in %s\n", filename);
+            exit(1);
+        }
+    num_ids = header[1];
+    blocks = calloc(num_ids, sizeof(void *));
+    done = calloc(num_ids, sizeof(int));
+    count = calloc(num_ids, sizeof(int));
+    if (!blocks || !done || !count) {
+        printf("Error: out of memory\n");
+        exit(1);
+    }
+
+    nthreads = 1;
+    while (fscanf(fp, "%15s", type) == 1) {
+        if (type[0] == 't') {
+            if (fscanf(fp, "%d", &tid) != 1 || tid < 0 || tid >= MAXTHREADS) {
+                printf("Error: bad thread id in %s\n", filename);
+                exit(1);
+            }
+            nthreads = (tid >= nthreads) ? tid + 1 : nthreads;
+            continue;
+        }
+        t = &rthreads[tid];
+        if (t->n == t->cap) {
+            t->cap = t->cap ? 2 * t->cap : 1024;
+            if ((t->ops = realloc(t->ops, t->cap * sizeof(rop_t))) == NULL) {
+                printf("Error: out of memory\n");
+                exit(1);
+            }
+        }
+        op = &t->ops[t->n];
+        op->type = type[0];
+        op->size = 0;
+        if ((type[0] != 'a' && type[0] != 'r' && type[0] != 'f') ||
+            fscanf(fp, "%d", &op->index) != 1 ||
+            (type[0] != 'f' && fscanf(fp, "%d", &op->size) != 1) ||
+            op->index < 0 || op->index >= num_ids) {
+            printf("Error: bad request in %s\n", filename);
+            exit(1);
+        }
+        op->want = count[op->index]++;
+        t->n++;
+    }
+    fclose(fp);
+    free(count);
+
+    for (i = 0; i < nthreads; i++)
+        if ((rthreads[i].lat = malloc((rthreads[i].n + 1) *
+                                      sizeof(unsigned))) == NULL) {
+            printf("Error: out of memory\n");
+            exit(1);
+        }
+}
+
+/* Thread routine: do one thread's requests of the trace */
+static void *replay_thread(void *vargp) {
+    rthread_t *t = (rthread_t *)vargp;
+    struct timespec t0, t1;
+    rop_t *op;
+    void *bp = NULL;
+    long i;
+
+    for (i = 0; i < t->n; i++) {
+        op = &t->ops[i];
+        while (__atomic_load_n(&done[op->index], __ATOMIC_ACQUIRE) != op->want)
+            sched_yield();
+
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        switch (op->type) {
+            case 'a': bp = malloc_fn(op->size); break;
+            case 'r': bp = realloc_fn(blocks[op->index], op->size); break;
+            case 'f': free_fn(blocks[op->index]); bp = NULL; break;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        t->lat[i] = (t1.tv_sec - t0.tv_sec) * 1000000000 +
+                    (t1.tv_nsec - t0.tv_nsec);
+
+        if (bp == NULL && op->type != 'f') {
+            printf("\nError: out of memory\n");
+            exit(1);
+        }
+        blocks[op->index] = bp;
+        __atomic_store_n(&done[op->index], op->want + 1, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+/* Start one thread per thread id in the trace and wait for them */
+static void run_replay(void *argp) {
+    pthread_t tid[MAXTHREADS];
+    int i;
+
+    for (i = 0; i < nthreads; i++)
+        pthread_create(&tid[i], NULL, replay_thread, &rthreads[i]);
+    for (i = 0; i < nthreads; i++)
+        pthread_join(tid[i], NULL);
+}
+
+static int by_value(const void *a, const void *b) {
+    unsigned x = *(const unsigned *)a, y = *(const unsigned *)b;
+
+    return (x > y) - (x < y);
+}
+
+/* Replay a trace on each allocator and report throughput and latency */
+static void replay(char *filename) {
+    int kind, i;
+    long total = 0;
+    rthread_t *t;
+    double secs;
+
+    read_replay(filename);
+    for (i = 0; i < nthreads; i++)
+        total += rthreads[i].n;
+    printf("%s: %ld requests on %d threads\n", filename, total, nthreads);
+
+    for (kind = 0; kind < NKINDS; kind++) {
+        set_kind(kind);
+        memset(done, 0, num_ids * sizeof(int));
+        secs = ftimer_gettod(run_replay, NULL, 1);
+
+        /* Free the blocks the trace left allocated */
+        for (i = 0; i < num_ids; i++) {
+            free_fn(blocks[i]);
+            blocks[i] = NULL;
+        }
+        if (kind != LIBC)
+            mt_deinit();
+
+        printf("\n%-8s %8.2f Mops/s\n", kind_name[kind], total / secs / 1e6);
+        printf("%8s%10s%10s%10s%10s\n", "thread", "requests", "p50 ns",
+               "p99 ns", "max ns");
+        for (i = 0; i < nthreads; i++) {
+            t = &rthreads[i];
+            if (t->n == 0)
+                continue;
+            qsort(t->lat, t->n, sizeof(unsigned), by_value);
+            printf("%8d%10ld%10u%10u%10u\n", i, t->n, t->lat[t->n / 2],
+                   t->lat[t->n * 99 / 100], t->lat[t->n - 1]);
+        }
+    }
+}
+
+/* Hold megabytes MB of small blocks in one arena, then check and free them */
+static void fill(long megabytes) {
+    unsigned int seed = 1;
+    size_t size, total = 0;
+    long n = 0, cap = 0, i;
+    char **bps = NULL;
+
+    if (megabytes < 1) {
+        printf("Error: invalid arguments\n");
+        exit(0);
+    }
+    if (mt_init(1, 1) < 0) {
+        printf("Error: mt_init failed\n");
+        exit(1);
+    }
+    while (total < (size_t)megabytes << 20) {
+        if (n == cap) {
+            cap = cap ? 2 * cap : 1024;
+            if ((bps = realloc(bps, cap * sizeof(char *))) == NULL) {
+                printf("Error: out of memory\n");
+                exit(1);
+            }
+        }
+        size = 8 + rand_r(&seed) % 4089;
+        if ((bps[n] = mt_malloc(size)) == NULL) {
+            printf("Error: mt_malloc failed after %zu MB\n", total >> 20);
+            exit(1);
+        }
+        memset(bps[n], (int)n, size);
+        total += size;
+        n++;
+    }
+    for (i = 0; i < n; i++) {
+        if (bps[i][0] != (char)i) {
+            printf("Error: block %ld was overwritten\n", i);
+            exit(1);
+        }
+        mt_free(bps[i]);
+    }
+    mt_deinit();
+    free(bps);
+    printf("%ld blocks, %zu MB: ok\n", n, total >> 20);
+}
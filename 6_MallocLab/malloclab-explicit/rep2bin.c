@@ -0,0 +1,113 @@
+/*
+ * rep2bin.c - Convert a text trace (.rep) to the binary trace format of
+ * tracefmt.h, which mdriver maps into memory without parsing.
+ *
+ * The input is read as a stream, so traces of any length convert in
+ * constant memory. The request count in the header is the number of
+ * requests actually read, and every block index is checked against
+ * num_ids. Thread tags are dropped, since binary requests have no
+ * thread field.
+ *
+ * Usage: rep2bin <in.rep> <out.bin>
+ */
+#define _FILE_OFFSET_BITS 64
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tracefmt.h"
+
+/* Read an unsigned decimal number, skipping white space; -1 at EOF */
+static long read_num(FILE *fp) {
+    long n;
+    int c;
+
+    while ((c = getc_unlocked(fp)) == ' ' || c == '\t' || c == '\n' ||
+           c == '\r')
+        ;
+    if (c < '0' || c > '9')
+        return -1;
+    for (n = 0; c >= '0' && c <= '9'; c = getc_unlocked(fp))
+        n = 10 * n + (c - '0');
+    ungetc(c, fp);
+    return n;
+}
+
+/* Read the type character of the next request; EOF at the end */
+static int read_type(FILE *fp) {
+    int c;
+
+    while ((c = getc_unlocked(fp)) == ' ' || c == '\t' || c == '\n' ||
+           c == '\r')
+        ;
+    return c;
+}
+
+int main(int argc, char **argv) {
+    FILE *in, *out;
+    tracehdr_t hdr;
+    traceop_t op;
+    long index, size;
+    int c;
+
+    if (argc != 3) {
+        printf("Usage: %s <in.rep> <out.bin>\n", argv[0]);
+        exit(0);
+    }
+    if ((in = fopen(argv[1], "r")) == NULL) {
+        perror(argv[1]);
+        exit(1);
+    }
+    if ((out = fopen(argv[2], "w")) == NULL) {
+        perror(argv[2]);
+        exit(1);
+    }
+
+    memcpy(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic));
+    hdr.sugg_heapsize = (int)read_num(in);
+    hdr.num_ids = (int)read_num(in);
+    hdr.num_ops = (int)read_num(in);
+    hdr.weight = (int)read_num(in);
+    if (hdr.weight < 0) {
+        printf("%s: bad trace header\n", argv[1]);
+        exit(1);
+    }
+    fwrite(&hdr, sizeof(hdr), 1, out);
+
+    memset(&op, 0, sizeof(op));
+    hdr.num_ops = 0;
+    while ((c = read_type(in)) != EOF) {
+        if (c == 't') {
+            read_num(in);
+            continue;
+        }
+        index = read_num(in);
+        size = (c == 'f') ? 0 : read_num(in);
+        if (index < 0 || index >= hdr.num_ids || size < 0) {
+            printf("%s: bad request %d\n", argv[1], hdr.num_ops);
+            exit(1);
+        }
+        switch (c) {
+            case 'a': op.type = ALLOC; break;
+            case 'r': op.type = REALLOC; break;
+            case 'f': op.type = FREE; break;
+            default:
+                printf("%s: bogus type character (%c)\n", argv[1], c);
+                exit(1);
+        }
+        op.index = (int)index;
+        op.size = (int)size;
+        fwrite(&op, sizeof(op), 1, out);
+        hdr.num_ops++;
+    }
+
+    /* Write the header again with the real request count */
+    rewind(out);
+    fwrite(&hdr, sizeof(hdr), 1, out);
+    if (fclose(out) != 0) {
+        perror(argv[2]);
+        exit(1);
+    }
+    fclose(in);
+    exit(0);
+}
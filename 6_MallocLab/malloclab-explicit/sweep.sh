@@ -0,0 +1,123 @@
+#!/bin/bash
+#
+# sweep.sh - Build mdriver once for every combination of the build-time
+# policies of mm.c, run each build on the same traces, and print one
+# table of utilization and throughput (Kops) per trace.
+#
+# Usage: sweep.sh "<cc> <cflags>" NAME=v1,v2,... ... [-- <mdriver args>]
+#
+# Each NAME=v1,v2 is a macro of mm.c and the values to try; the builds
+# cover every combination. "make sweep" passes the Makefile's SWEEP list,
+# and SWEEPARGS to mdriver, e.g.
+#   linux> make sweep SWEEPARGS="-f traces/realloc-bal.rep"
+#
+# The builds go to a temporary directory, so the tree is left alone.
+#
+cc=$1
+shift
+axes=()
+while [ $# -gt 0 ] && [ "$1" != "--" ]; do
+    axes+=("$1")
+    shift
+done
+[ "$1" = "--" ] && shift
+
+if [ -z "$cc" ] || [ ${#axes[@]} -eq 0 ]; then
+    echo "Usage: $0 \"<cc> <cflags>\" NAME=v1,v2,... ... [-- <mdriver args>]"
+    exit 1
+fi
+
+dir=$(mktemp -d "${TMPDIR:-/tmp}/sweep.XXXXXX") || exit 1
+trap 'rm -rf "$dir"' EXIT
+
+# The driver objects are the same for every variant. Compiler output is
+# only shown when a build fails.
+for f in mdriver memlib fsecs fcyc clock ftimer; do
+    if ! $cc -c -o "$dir/$f.o" $f.c 2> "$dir/log"; then
+        cat "$dir/log"
+        exit 1
+    fi
+done
+
+# Every combination, as -D flags and as a label of the values
+flags=("")
+labels=("")
+for axis in "${axes[@]}"; do
+    name=${axis%%=*}
+    newflags=()
+    newlabels=()
+    for k in "${!flags[@]}"; do
+        IFS=, read -ra vals <<< "${axis#*=}"
+        for v in "${vals[@]}"; do
+            newflags+=("${flags[$k]} -D$name=$v")
+            newlabels+=("${labels[$k]}${labels[$k]:+/}$v")
+        done
+    done
+    flags=("${newflags[@]}")
+    labels=("${newlabels[@]}")
+done
+
+for axis in "${axes[@]}"; do
+    legend="$legend${legend:+/}${axis%%=*}"
+done
+
+# The variant column fits the longest label
+width=16
+for label in "${labels[@]}"; do
+    [ ${#label} -ge $width ] && width=$((${#label} + 1))
+done
+echo "Policy sweep, variant = $legend"
+
+first=1
+for k in "${!flags[@]}"; do
+    if ! $cc ${flags[$k]} -c -o "$dir/mm.o" mm.c 2> "$dir/log" ||
+        ! $cc -o "$dir/mdriver" "$dir"/{mdriver,mm,memlib,fsecs,fcyc,clock,ftimer}.o \
+            2>> "$dir/log"; then
+        cat "$dir/log"
+        echo "${labels[$k]}: build failed"
+        continue
+    fi
+
+    # Pull the rows of mdriver's results table. Kops is recomputed from
+    # ops and secs, since a wide Kops runs into the secs column.
+    "$dir/mdriver" -v "$@" 2>&1 | awk -v label="${labels[$k]}" -v first=$first -v w=$width '
+        BEGIN { n = 0; col = "%-" w "s" }
+        /^Results for mm malloc/ { on = 1; next }
+        on && /^trace/ { next }
+        on && /^Total/ { util[n] = $2; ops = $3; secs = $4; total = 1 }
+        on && /^ *[0-9]+ / {
+            util[n] = ($2 == "yes") ? $3 : "-"
+            ops = $4; secs = $5
+        }
+        on && (/^Total/ || /^ *[0-9]+ /) {
+            if (util[n] == "-") {
+                kops[n] = "-"
+            } else {
+                secs = substr(secs, 1, index(secs, ".") + 6)
+                kops[n] = (secs > 0) ? sprintf("%.0f", ops / secs / 1000) : "-"
+            }
+            name[n] = total ? "Total" : n
+            n++
+            if (total) on = 0
+        }
+        END {
+            if (n == 0) {
+                printf(col " mdriver failed\n", label)
+                exit
+            }
+            if (first) {
+                printf(col "%6s", "variant", "")
+                for (i = 0; i < n; i++)
+                    printf("%8s", name[i])
+                printf("\n")
+            }
+            printf(col "%6s", label, "util")
+            for (i = 0; i < n; i++)
+                printf("%8s", util[i])
+            printf("\n" col "%6s", "", "Kops")
+            for (i = 0; i < n; i++)
+                printf("%8s", kops[i])
+            printf("\n")
+        }'
+    first=0
+done
@@ -0,0 +1,34 @@
+/*
+ * tracefmt.h - Trace requests, and the binary trace format
+ *
+ * A binary trace is a tracehdr_t followed by num_ops traceop_t records,
+ * in the host's byte order. mdriver maps the records straight into
+ * memory instead of parsing them; rep2bin converts a text (.rep) trace.
+ *
+ * A text trace may say which thread made each request: a line "t <n>"
+ * tags the requests after it with thread n (0 until the first tag).
+ * mtbench -f replays such a trace on threads; mdriver and rep2bin skip
+ * the tags.
+ */
+#ifndef __TRACEFMT_H_
+#define __TRACEFMT_H_
+
+#define TRACE_MAGIC "MMTRACE1"
+
+/* Characterizes a single trace operation (allocator request) */
+typedef struct {
+    enum { ALLOC, FREE, REALLOC } type; /* type of request */
+    int index;                          /* index for free() to use later */
+    int size;                           /* byte size of alloc/realloc request */
+} traceop_t;
+
+/* The four numbers at the top of a text trace, after a magic string */
+typedef struct {
+    char magic[8];     /* TRACE_MAGIC, without the NUL */
+    int sugg_heapsize; /* suggested heap size (unused) */
+    int num_ids;       /* number of alloc/realloc ids */
+    int num_ops;       /* number of requests that follow */
+    int weight;        /* weight for this trace (unused) */
+} tracehdr_t;
+
+#endif /* __TRACEFMT_H_ */
@@ -58,7 +58,7 @@
 #define ALIGNMENT 8
 
 /*
- * Maximum heap size in bytes
+ * Default maximum heap size in bytes (mdriver -M overrides it)
  */
 #define MAX_HEAP (20*(1<<20))  /* 20 MB */
 
@@ -7,19 +7,28 @@
  * Copyright (c) 2002, R. Bryant and D. O'Hallaron, All rights reserved.
  * May not be used, modified, or copied without permission.
  */
+#define _FILE_OFFSET_BITS 64 /* binary traces may exceed 2 GB */
+#define _GNU_SOURCE          /* sched_setaffinity */
 #include <assert.h>
 #include <errno.h>
 #include <float.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/wait.h>
 #include <time.h>
 #include <unistd.h>
 
+#include "clock.h"
 #include "config.h"
 #include "fsecs.h"
 #include "memlib.h"
 #include "mm.h"
+#include "tracefmt.h"
 
 /**********************
  * Constants and macros
@@ -30,6 +39,19 @@
 #define HDRLINES 4         /* number of header lines in a trace file */
 #define LINENUM(i) (i + 5) /* cnvt trace request nums to linenums (origin 1) \
                             */
+#define TRACE_WINDOW (1 << 20) /* requests mapped at a time (binary traces) */
+
+/* Latency histograms (-L): LAT_SUB buckets per power of two, so a
+ * percentile read from a bucket is within 1/LAT_SUB of the true value */
+#define LAT_SUB 16
+#define LAT_BUCKETS (LAT_SUB + 60 * LAT_SUB)
+#define LAT_TYPES 3 /* ALLOC, FREE, REALLOC */
+
+/* Request i of a trace, mapping the window that holds it if need be */
+#define TRACE_OP(trace, i)                                             \
+    ((unsigned)((i) - (trace)->ops_lo) < (unsigned)(trace)->ops_n      \
+         ? &(trace)->ops[(i) - (trace)->ops_lo]                        \
+         : trace_window((trace), (i)))
 
 /* Returns true if p is ALIGNMENT-byte aligned */
 #define IS_ALIGNED(p) ((((unsigned int)(p)) % ALIGNMENT) == 0)
@@ -45,20 +67,18 @@ typedef struct range_t {
     struct range_t *next; /* next list element */
 } range_t;
 
-/* Characterizes a single trace operation (allocator request) */
-typedef struct {
-    enum { ALLOC, FREE, REALLOC } type; /* type of request */
-    int index;                          /* index for free() to use later */
-    int size;                           /* byte size of alloc/realloc request */
-} traceop_t;
-
 /* Holds the information for one trace file*/
 typedef struct {
     int sugg_heapsize;   /* suggested heap size (unused) */
     int num_ids;         /* number of alloc/realloc ids */
     int num_ops;         /* number of distinct requests */
     int weight;          /* weight for this trace (unused) */
-    traceop_t *ops;      /* array of requests */
+    traceop_t *ops;      /* array of requests ops_lo .. ops_lo + ops_n - 1 */
+    int ops_lo;          /* (all of them for a text trace, one window of */
+    int ops_n;           /* TRACE_WINDOW for a binary trace) */
+    int fd;              /* binary trace file, or -1 */
+    void *map;           /* mapping that holds the current window ... */
+    size_t maplen;       /* ... and its length */
     char **blocks;       /* array of ptrs returned by malloc/realloc... */
     size_t *block_sizes; /* ... and a corresponding array of payload sizes */
 } trace_t;
@@ -82,6 +102,16 @@ typedef struct {
 
     /* defined only for the student malloc package */
     double util; /* space utilization for this trace (always 0 for libc) */
+    double reallocs;     /* number of realloc requests */
+    double inplace;      /* ... that returned the block they were given */
+    double copy_avoided; /* payload bytes those did not have to copy */
+    double peak_total;   /* largest heap plus mapped size during the trace */
+    double final_heap;   /* heap size at the end of the trace ... */
+    double resident;     /* ... and how much of it is backed by memory */
+    double mapped;       /* bytes still mapped at the end of the trace */
+    double sbrks;        /* mem_sbrk calls during the trace */
+    double lat_count[LAT_TYPES];  /* requests of each type timed by -L ... */
+    double lat_pct[LAT_TYPES][4]; /* ... and their p50, p99, p99.9 and max */
 
     /* Note: secs and util are only defined if valid is true */
 } stats_t;
@@ -99,6 +129,17 @@ static char tracedir[MAXLINE] = TRACEDIR;
 /* The filenames of the default tracefiles */
 static char *default_tracefiles[] = {DEFAULT_TRACEFILES, NULL};
 
+/* Cycles per request of each type over all traces (-L), and the cost of
+ * reading the cycle counter, which is subtracted from every sample */
+static double lat_hist[LAT_TYPES][LAT_BUCKETS];
+static double lat_overhead;
+static char *lat_names[LAT_TYPES] = {"malloc", "free", "realloc"};
+
+/* Timeline (-P): eval_mm_util samples the heap every timeline_every
+ * requests into timeline_fp */
+static int timeline_every = 0;
+static FILE *timeline_fp = NULL;
+
 /*********************
  * Function prototypes
  *********************/
@@ -111,6 +152,8 @@ static void clear_ranges(range_t **ranges);
 
 /* These functions read, allocate, and free storage for traces */
 static trace_t *read_trace(char *tracedir, char *filename);
+static int read_binary_trace(trace_t *trace, int fd, char *path);
+static traceop_t *trace_window(trace_t *trace, int i);
 static void free_trace(trace_t *trace);
 
 /* Routines for evaluating the correctness and speed of libc malloc */
@@ -120,11 +163,27 @@ static void eval_libc_speed(void *ptr);
 /* Routines for evaluating correctnes, space utilization, and speed
    of the student's malloc package in mm.c */
 static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges);
-static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges);
+static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges,
+                           stats_t *stats);
 static void eval_mm_speed(void *ptr);
+static void eval_mm_latency(trace_t *trace, stats_t *stats);
+static void eval_mm_trace(char *filename, int tracenum, stats_t *stats,
+                          int latency);
+static void eval_mm_parallel(char **tracefiles, int n, stats_t *stats,
+                             int latency, int jobs);
+static void read_full(int fd, void *buf, size_t len);
+static void timeline_open(char *filename);
+static void timeline_sample(int ops, int live);
+
+/* These functions bucket cycle counts for the latency histograms */
+static int lat_bucket(double cycles);
+static double lat_bound(int bucket);
 
 /* Various helper routines */
 static void printresults(int n, stats_t *stats);
+static void printreallocs(int n, stats_t *stats);
+static void printheap(int n, stats_t *stats);
+static void printlatency(int n, stats_t *stats);
 static void usage(void);
 static void unix_error(char *msg);
 static void malloc_error(int tracenum, int opnum, char *msg);
@@ -139,7 +198,6 @@ int main(int argc, char **argv) {
     char **tracefiles = NULL;   /* null-terminated array of trace file names */
     int num_tracefiles = 0;     /* the number of traces in that array */
     trace_t *trace = NULL;      /* stores a single trace file in memory */
-    range_t *ranges = NULL;     /* keeps track of block extents for one trace */
     stats_t *libc_stats = NULL; /* libc stats for each trace */
     stats_t *mm_stats = NULL;   /* mm (i.e. student) stats for each trace */
     speed_t speed_params;       /* input parameters to the xx_speed routines */
@@ -147,6 +205,8 @@ int main(int argc, char **argv) {
     int team_check = 1; /* If set, check team structure (reset by -a) */
     int run_libc = 0;   /* If set, run libc malloc (set by -l) */
     int autograder = 0; /* If set, emit summary info for autograder (-g) */
+    int latency = 0;    /* If set, time every request (set by -L) */
+    int jobs = 1;       /* Traces evaluated at once (set by -j) */
 
     /* temporaries used to compute the performance index */
     double secs, ops, util, avg_mm_util, avg_mm_throughput, p1, p2, perfindex;
@@ -155,7 +215,7 @@ int main(int argc, char **argv) {
     /*
      * Read and interpret the command line arguments
      */
-    while ((c = getopt(argc, argv, "f:t:hvVgal")) != EOF) {
+    while ((c = getopt(argc, argv, "f:t:M:P:j:hvVgalL")) != EOF) {
         switch (c) {
             case 'g': /* Generate summary info for the autograder */
                 autograder = 1;
@@ -177,12 +237,30 @@ int main(int argc, char **argv) {
                 if (tracedir[strlen(tracedir) - 1] != '/')
                     strcat(tracedir, "/"); /* path always ends with "/" */
                 break;
+            case 'M': /* Maximum size of the simulated heap, in MB */
+                mem_set_max_heap((size_t)atol(optarg) << 20);
+                break;
             case 'a': /* Don't check team structure */
                 team_check = 0;
                 break;
             case 'l': /* Run libc malloc */
                 run_libc = 1;
                 break;
+            case 'L': /* Per-request latency histograms */
+                latency = 1;
+                break;
+            case 'j': /* Evaluate traces in <n> worker processes */
+                if ((jobs = atoi(optarg)) <= 0) {
+                    usage();
+                    exit(1);
+                }
+                break;
+            case 'P': /* Heap timeline, sampled every <n> requests */
+                if ((timeline_every = atoi(optarg)) <= 0) {
+                    usage();
+                    exit(1);
+                }
+                break;
             case 'v': /* Print per-trace performance breakdown */
                 verbose = 1;
                 break;
@@ -239,6 +317,13 @@ int main(int argc, char **argv) {
     /* Initialize the timing package */
     init_fsecs();
 
+    /* Calibrate the cycle counter: the cheapest of many empty readings */
+    if (latency) {
+        lat_overhead = ovhd();
+        for (i = 0; i < 1000; i++)
+            if (ovhd() < lat_overhead) lat_overhead = ovhd();
+    }
+
     /*
      * Optionally run and evaluate the libc malloc package
      */
@@ -279,32 +364,25 @@ int main(int argc, char **argv) {
     mm_stats = (stats_t *)calloc(num_tracefiles, sizeof(stats_t));
     if (mm_stats == NULL) unix_error("mm_stats calloc in main failed");
 
-    /* Initialize the simulated memory system in memlib.c */
-    mem_init();
-
     /* Evaluate student's mm malloc package using the K-best scheme */
-    for (i = 0; i < num_tracefiles; i++) {
-        trace = read_trace(tracedir, tracefiles[i]);
-        mm_stats[i].ops = trace->num_ops;
-        if (verbose > 1) printf("Checking mm_malloc for correctness, ");
-        mm_stats[i].valid = eval_mm_valid(trace, i, &ranges);
-        if (mm_stats[i].valid) {
-            if (verbose > 1) printf("efficiency, ");
-            mm_stats[i].util = eval_mm_util(trace, i, &ranges);
-            speed_params.trace = trace;
-            speed_params.ranges = ranges;
-            if (verbose > 1) printf("and performance.\n");
-            mm_stats[i].secs = fsecs(eval_mm_speed, &speed_params);
-        }
-        free_trace(trace);
+    if (jobs > 1 && num_tracefiles > 1) {
+        eval_mm_parallel(tracefiles, num_tracefiles, mm_stats, latency, jobs);
+    } else {
+        /* Initialize the simulated memory system in memlib.c */
+        mem_init();
+        for (i = 0; i < num_tracefiles; i++)
+            eval_mm_trace(tracefiles[i], i, &mm_stats[i], latency);
     }
 
     /* Display the mm results in a compact table */
     if (verbose) {
         printf("\nResults for mm malloc:\n");
         printresults(num_tracefiles, mm_stats);
+        printreallocs(num_tracefiles, mm_stats);
+        printheap(num_tracefiles, mm_stats);
         printf("\n");
     }
+    if (latency) printlatency(num_tracefiles, mm_stats);
 
     /*
      * Accumulate the aggregate statistics for the student's mm package
@@ -351,6 +429,129 @@ int main(int argc, char **argv) {
     exit(0);
 }
 
+/*
+ * eval_mm_trace - Evaluate the mm package on one trace file: check it for
+ *     correctness, then measure its utilization, throughput and (with -L)
+ *     latency, filling in stats
+ */
+static void eval_mm_trace(char *filename, int tracenum, stats_t *stats,
+                          int latency) {
+    static range_t *ranges = NULL; /* block extents for one trace */
+    speed_t speed_params;          /* input parameters to eval_mm_speed */
+    trace_t *trace;
+
+    trace = read_trace(tracedir, filename);
+    stats->ops = trace->num_ops;
+    if (verbose > 1) printf("Checking mm_malloc for correctness, ");
+    stats->valid = eval_mm_valid(trace, tracenum, &ranges);
+    if (stats->valid) {
+        if (verbose > 1) printf("efficiency, ");
+        if (timeline_every) timeline_open(filename);
+        stats->util = eval_mm_util(trace, tracenum, &ranges, stats);
+        if (timeline_fp) fclose(timeline_fp);
+        timeline_fp = NULL;
+        speed_params.trace = trace;
+        speed_params.ranges = ranges;
+        if (verbose > 1) printf("and performance.\n");
+        stats->secs = fsecs(eval_mm_speed, &speed_params);
+        if (latency) eval_mm_latency(trace, stats);
+    }
+    free_trace(trace);
+}
+
+/*
+ * eval_mm_parallel - Evaluate n traces in jobs worker processes, each
+ *     pinned to its own CPU (round-robin if there are fewer CPUs) with a
+ *     simulated heap of its own. Workers take the next unclaimed trace
+ *     from a shared counter, and send back each trace's stats, their
+ *     error count and their latency samples through a pipe of their own
+ *     (records from several workers on one pipe could interleave).
+ */
+static void eval_mm_parallel(char **tracefiles, int n, stats_t *stats,
+                             int latency, int jobs) {
+    int *next, *fds, fd[2], w, i, nerrors, ncpus;
+    double hist[LAT_TYPES][LAT_BUCKETS];
+    cpu_set_t cpus;
+    pid_t pid;
+
+    if (jobs > n) jobs = n;
+    ncpus = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (ncpus < 1) ncpus = 1;
+    next = mmap(NULL, sizeof(int), PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (next == MAP_FAILED) unix_error("mmap failed in eval_mm_parallel");
+    *next = 0;
+    fds = (int *)malloc(jobs * sizeof(int));
+    if (fds == NULL) unix_error("malloc failed in eval_mm_parallel");
+    fflush(stdout); /* or the workers print it again */
+
+    for (w = 0; w < jobs; w++) {
+        if (pipe(fd) < 0) unix_error("pipe failed in eval_mm_parallel");
+        if ((pid = fork()) < 0) unix_error("fork failed in eval_mm_parallel");
+        if (pid > 0) {
+            close(fd[1]);
+            fds[w] = fd[0];
+            continue;
+        }
+
+        /* Worker */
+        close(fd[0]);
+        for (i = 0; i < w; i++) close(fds[i]);
+        CPU_ZERO(&cpus);
+        CPU_SET(w % ncpus, &cpus);
+        sched_setaffinity(0, sizeof(cpus), &cpus);
+        mem_init();
+        while ((i = __atomic_fetch_add(next, 1, __ATOMIC_RELAXED)) < n) {
+            nerrors = errors;
+            eval_mm_trace(tracefiles[i], i, &stats[i], latency);
+            nerrors = errors - nerrors;
+            fflush(stdout);
+            if (write(fd[1], &i, sizeof(i)) != sizeof(i) ||
+                write(fd[1], &nerrors, sizeof(nerrors)) != sizeof(nerrors) ||
+                write(fd[1], &stats[i], sizeof(stats_t)) != sizeof(stats_t))
+                unix_error("write failed in eval_mm_parallel");
+        }
+        i = -1; /* End of this worker's traces */
+        if (write(fd[1], &i, sizeof(i)) != sizeof(i) ||
+            write(fd[1], lat_hist, sizeof(lat_hist)) != sizeof(lat_hist))
+            unix_error("write failed in eval_mm_parallel");
+        exit(0);
+    }
+
+    /* Collect each worker's results until it signs off */
+    for (w = 0; w < jobs; w++) {
+        while (read_full(fds[w], &i, sizeof(i)), i >= 0) {
+            read_full(fds[w], &nerrors, sizeof(nerrors));
+            read_full(fds[w], &stats[i], sizeof(stats_t));
+            errors += nerrors;
+        }
+        read_full(fds[w], hist, sizeof(hist));
+        for (i = 0; i < LAT_TYPES * LAT_BUCKETS; i++)
+            lat_hist[i / LAT_BUCKETS][i % LAT_BUCKETS] +=
+                hist[i / LAT_BUCKETS][i % LAT_BUCKETS];
+        close(fds[w]);
+    }
+    while (wait(NULL) > 0)
+        ;
+    free(fds);
+    munmap(next, sizeof(int));
+}
+
+/*
+ * read_full - Read exactly len bytes from a pipe, or quit if a worker
+ *     died before sending them
+ */
+static void read_full(int fd, void *buf, size_t len) {
+    ssize_t rc;
+
+    while (len > 0) {
+        if ((rc = read(fd, buf, len)) <= 0)
+            app_error("A worker process died in eval_mm_parallel");
+        buf = (char *)buf + rc;
+        len -= rc;
+    }
+}
+
 /*****************************************************************
  * The following routines manipulate the range list, which keeps
  * track of the extent of every allocated block payload. We use the
@@ -379,11 +580,12 @@ static int add_range(range_t **ranges, char *lo, int size, int tracenum,
         return 0;
     }
 
-    /* The payload must lie within the extent of the heap */
-    if ((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) ||
-        (hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) {
-        sprintf(msg, "Payload (%p:%p) lies outside heap (%p:%p)", lo, hi,
-                mem_heap_lo(), mem_heap_hi());
+    /* The payload must lie within the extent of the heap, or within one
+     * region mapped with mem_map */
+    if (!mem_contains(lo, hi)) {
+        sprintf(msg,
+                "Payload (%p:%p) lies outside heap (%p:%p) and mapped regions",
+                lo, hi, mem_heap_lo(), mem_heap_hi());
         malloc_error(tracenum, opnum, msg);
         return 0;
     }
@@ -454,11 +656,13 @@ static void clear_ranges(range_t **ranges) {
 static trace_t *read_trace(char *tracedir, char *filename) {
     FILE *tracefile;
     trace_t *trace;
+    tracehdr_t hdr;
     char type[MAXLINE];
     char path[MAXLINE];
     unsigned index, size;
     unsigned max_index = 0;
     unsigned op_index;
+    int binary;
 
     if (verbose > 1) printf("Reading tracefile: %s\n", filename);
 
@@ -473,15 +677,37 @@ static trace_t *read_trace(char *tracedir, char *filename) {
         sprintf(msg, "Could not open %s in read_trace", path);
         unix_error(msg);
     }
-    fscanf(tracefile, "%d", &(trace->sugg_heapsize)); /* not used */
-    fscanf(tracefile, "%d", &(trace->num_ids));
-    fscanf(tracefile, "%d", &(trace->num_ops));
-    fscanf(tracefile, "%d", &(trace->weight)); /* not used */
-
-    /* We'll store each request line in the trace in this array */
-    if ((trace->ops =
-             (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
-        unix_error("malloc 2 failed in read_trace");
+    trace->fd = -1;
+    trace->map = NULL;
+    trace->ops = NULL;
+    trace->ops_lo = trace->ops_n = 0;
+
+    /* A binary trace (see tracefmt.h) is mapped rather than parsed */
+    binary = fread(&hdr, sizeof(hdr), 1, tracefile) == 1 &&
+             memcmp(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic)) == 0;
+    if (binary) {
+        trace->sugg_heapsize = hdr.sugg_heapsize;
+        trace->num_ids = hdr.num_ids;
+        trace->num_ops = hdr.num_ops;
+        trace->weight = hdr.weight;
+        if (!read_binary_trace(trace, dup(fileno(tracefile)), path)) {
+            printf("Truncated binary trace %s\n", path);
+            exit(1);
+        }
+        fclose(tracefile);
+    } else {
+        rewind(tracefile);
+        fscanf(tracefile, "%d", &(trace->sugg_heapsize)); /* not used */
+        fscanf(tracefile, "%d", &(trace->num_ids));
+        fscanf(tracefile, "%d", &(trace->num_ops));
+        fscanf(tracefile, "%d", &(trace->weight)); /* not used */
+
+        /* We'll store each request line in the trace in this array */
+        if ((trace->ops = (traceop_t *)malloc(trace->num_ops *
+                                              sizeof(traceop_t))) == NULL)
+            unix_error("malloc 2 failed in read_trace");
+        trace->ops_n = trace->num_ops;
+    }
 
     /* We'll keep an array of pointers to the allocated blocks here... */
     if ((trace->blocks = (char **)malloc(trace->num_ids * sizeof(char *))) ==
@@ -492,6 +718,8 @@ static trace_t *read_trace(char *tracedir, char *filename) {
     if ((trace->block_sizes =
              (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
         unix_error("malloc 4 failed in read_trace");
+    if (binary)
+        return trace;
 
     /* read every request line in the trace file */
     index = 0;
@@ -517,6 +745,9 @@ static trace_t *read_trace(char *tracedir, char *filename) {
                 trace->ops[op_index].type = FREE;
                 trace->ops[op_index].index = index;
                 break;
+            case 't': /* thread tag, only used by mtbench -f */
+                fscanf(tracefile, "%u", &size);
+                continue;
             default:
                 printf("Bogus type character (%c) in tracefile %s\n", type[0],
                        path);
@@ -531,12 +762,73 @@ static trace_t *read_trace(char *tracedir, char *filename) {
     return trace;
 }
 
+/*
+ * read_binary_trace - Check that binary trace file fd holds as many
+ *     requests as its header says, and keep it open for trace_window.
+ *     Requests are mapped TRACE_WINDOW at a time as the trace is run,
+ *     so a trace larger than memory (or the address space) streams
+ *     through. Returns 0 if the file is too short.
+ */
+static int read_binary_trace(trace_t *trace, int fd, char *path) {
+    struct stat st;
+
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        sprintf(msg, "Could not open %s in read_binary_trace", path);
+        unix_error(msg);
+    }
+    if (trace->num_ops < 0 ||
+        (off_t)st.st_size < (off_t)sizeof(tracehdr_t) +
+                                (off_t)trace->num_ops * sizeof(traceop_t)) {
+        close(fd);
+        return 0;
+    }
+    trace->fd = fd;
+    return 1;
+}
+
+/*
+ * trace_window - Map the window of a binary trace that holds request i,
+ *     in place of the current one, and return the request. The driver
+ *     runs traces in order, so the kernel is told to read ahead.
+ */
+static traceop_t *trace_window(trace_t *trace, int i) {
+    off_t off, start;
+    long pagesize = sysconf(_SC_PAGESIZE);
+    char *p;
+
+    if (trace->map != NULL)
+        munmap(trace->map, trace->maplen);
+    trace->map = NULL;
+
+    trace->ops_lo = i - i % TRACE_WINDOW;
+    trace->ops_n = trace->num_ops - trace->ops_lo;
+    if (trace->ops_n > TRACE_WINDOW)
+        trace->ops_n = TRACE_WINDOW;
+
+    /* mmap offsets must be page aligned */
+    off = sizeof(tracehdr_t) + (off_t)trace->ops_lo * sizeof(traceop_t);
+    start = off - off % pagesize;
+    trace->maplen = (off - start) + (size_t)trace->ops_n * sizeof(traceop_t);
+    p = mmap(NULL, trace->maplen, PROT_READ, MAP_PRIVATE, trace->fd, start);
+    if (p == MAP_FAILED)
+        unix_error("mmap failed in trace_window");
+    madvise(p, trace->maplen, MADV_SEQUENTIAL);
+    trace->map = p;
+    trace->ops = (traceop_t *)(p + (off - start));
+    return &trace->ops[i - trace->ops_lo];
+}
+
 /*
  * free_trace - Free the trace record and the three arrays it points
  *              to, all of which were allocated in read_trace().
  */
 void free_trace(trace_t *trace) {
-    free(trace->ops); /* free the three arrays... */
+    if (trace->fd >= 0) { /* unmap a binary trace... */
+        if (trace->map != NULL)
+            munmap(trace->map, trace->maplen);
+        close(trace->fd);
+    } else
+        free(trace->ops); /* ...or free the three arrays... */
     free(trace->blocks);
     free(trace->block_sizes);
     free(trace); /* and the trace record itself... */
@@ -551,6 +843,7 @@ void free_trace(trace_t *trace) {
  * eval_mm_valid - Check the mm malloc package for correctness
  */
 static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges) {
+    traceop_t *op;
     int i, j;
     int index;
     int size;
@@ -571,10 +864,17 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges) {
 
     /* Interpret each operation in the trace in order */
     for (i = 0; i < trace->num_ops; i++) {
-        index = trace->ops[i].index;
-        size = trace->ops[i].size;
+        op = TRACE_OP(trace, i);
+        index = op->index;
+        size = op->size;
 
-        switch (trace->ops[i].type) {
+        /* Binary traces are not parsed, so check the index here */
+        if (index < 0 || index >= trace->num_ids) {
+            malloc_error(tracenum, i, "Bad block index in trace.");
+            return 0;
+        }
+
+        switch (op->type) {
             case ALLOC: /* mm_malloc */
 
                 /* Call the student's malloc */
@@ -625,7 +925,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges) {
                 oldsize = trace->block_sizes[index];
                 if (size < oldsize) oldsize = size;
                 for (j = 0; j < oldsize; j++) {
-                    if (newp[j] != (index & 0xFF)) {
+                    if ((unsigned char)newp[j] != (index & 0xFF)) {
                         malloc_error(tracenum, i,
                                      "mm_realloc did not preserve the "
                                      "data from old block");
@@ -661,13 +961,19 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges) {
  *   The idea is to remember the high water mark "hwm" of the heap for
  *   an optimal allocator, i.e., no gaps and no internal fragmentation.
  *   Utilization is the ratio hwm/heapsize, where heapsize is the
- *   size of the heap in bytes after running the student's malloc
- *   package on the trace. Note that our implementation of mem_sbrk()
- *   doesn't allow the students to decrement the brk pointer, so brk
- *   is always the high water mark of the heap.
+ *   largest size of the heap plus the regions mapped with mem_map, in
+ *   bytes, while running the student's malloc package on the trace. The
+ *   heap may shrink again (mem_sbrk accepts a negative increment), so
+ *   this is the peak rather than the final size.
  *
+ *   Also counts the reallocs that mm_realloc served in place, and the
+ *   payload bytes a malloc/copy/free realloc would have copied for them,
+ *   and records the peak and final heap sizes and how much of the final
+ *   heap is still resident.
  */
-static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges) {
+static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges,
+                           stats_t *stats) {
+    traceop_t *op;
     int i;
     int index;
     int size, newsize, oldsize;
@@ -676,15 +982,19 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges) {
     char *p;
     char *newp, *oldp;
 
-    /* initialize the heap and the mm malloc package */
+    /* initialize the heap and the mm malloc package. Pages the last run
+     * touched are dropped so that residency reflects this trace only. */
+    mem_release(mem_heap_lo(), mem_peak_heapsize());
     mem_reset_brk();
     if (mm_init() < 0) app_error("mm_init failed in eval_mm_util");
+    if (timeline_fp) timeline_sample(0, 0);
 
     for (i = 0; i < trace->num_ops; i++) {
-        switch (trace->ops[i].type) {
+        op = TRACE_OP(trace, i);
+        switch (op->type) {
             case ALLOC: /* mm_alloc */
-                index = trace->ops[i].index;
-                size = trace->ops[i].size;
+                index = op->index;
+                size = op->size;
 
                 if ((p = mm_malloc(size)) == NULL)
                     app_error("mm_malloc failed in eval_mm_util");
@@ -703,14 +1013,21 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges) {
                 break;
 
             case REALLOC: /* mm_realloc */
-                index = trace->ops[i].index;
-                newsize = trace->ops[i].size;
+                index = op->index;
+                newsize = op->size;
                 oldsize = trace->block_sizes[index];
 
                 oldp = trace->blocks[index];
                 if ((newp = mm_realloc(oldp, newsize)) == NULL)
                     app_error("mm_realloc failed in eval_mm_util");
 
+                stats->reallocs++;
+                if (newp == oldp) {
+                    stats->inplace++;
+                    stats->copy_avoided +=
+                        (newsize < oldsize) ? newsize : oldsize;
+                }
+
                 /* Remember region and size */
                 trace->blocks[index] = newp;
                 trace->block_sizes[index] = newsize;
@@ -725,7 +1042,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges) {
                 break;
 
             case FREE: /* mm_free */
-                index = trace->ops[i].index;
+                index = op->index;
                 size = trace->block_sizes[index];
                 p = trace->blocks[index];
 
@@ -740,9 +1057,54 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges) {
             default:
                 app_error("Nonexistent request type in eval_mm_util");
         }
+
+        if (timeline_fp &&
+            ((i + 1) % timeline_every == 0 || i + 1 == trace->num_ops))
+            timeline_sample(i + 1, total_size);
     }
 
-    return ((double)max_total_size / (double)mem_heapsize());
+    stats->peak_total = mem_peak_footprint();
+    stats->final_heap = mem_heapsize();
+    stats->resident = mem_resident();
+    stats->mapped = mem_mapsize();
+    stats->sbrks = mem_sbrk_calls();
+    return ((double)max_total_size / (double)mem_peak_footprint());
+}
+
+/*
+ * timeline_open - Start the timeline CSV of a trace: foo.rep gets
+ *    foo.csv in the current directory, one row per sample, ready for
+ *    a spreadsheet or gnuplot
+ */
+static void timeline_open(char *filename) {
+    char path[MAXLINE], *base, *dot;
+
+    base = strrchr(filename, '/') ? strrchr(filename, '/') + 1 : filename;
+    strcpy(path, base);
+    if ((dot = strrchr(path, '.')) != NULL) *dot = '\0';
+    strcat(path, ".csv");
+    if ((timeline_fp = fopen(path, "w")) == NULL) unix_error(path);
+    fprintf(timeline_fp,
+            "ops,heap,live,free_blocks,free_bytes,largest_free,ext_frag,"
+            "util\n");
+}
+
+/*
+ * timeline_sample - Write one timeline row after ops requests, with live
+ *    payload bytes: the heap (plus mapped) size, the allocator's free
+ *    blocks (mm_freestats), external fragmentation (the share of free
+ *    space outside the largest free block) and live / heap
+ */
+static void timeline_sample(int ops, int live) {
+    size_t count, total, largest;
+    double heap = (double)mem_heapsize() + mem_mapsize();
+
+    mm_freestats(&count, &total, &largest);
+    fprintf(timeline_fp, "%d,%.0f,%d,%lu,%lu,%lu,%.4f,%.4f\n", ops, heap,
+            live, (unsigned long)count, (unsigned long)total,
+            (unsigned long)largest,
+            total ? 1.0 - (double)largest / total : 0.0,
+            heap ? live / heap : 0.0);
 }
 
 /*
@@ -750,6 +1112,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges) {
  *    to measure the running time of the mm malloc package.
  */
 static void eval_mm_speed(void *ptr) {
+    traceop_t *op;
     int i, index, size, newsize;
     char *p, *newp, *oldp, *block;
     trace_t *trace = ((speed_t *)ptr)->trace;
@@ -759,18 +1122,19 @@ static void eval_mm_speed(void *ptr) {
     if (mm_init() < 0) app_error("mm_init failed in eval_mm_speed");
 
     /* Interpret each trace request */
-    for (i = 0; i < trace->num_ops; i++) switch (trace->ops[i].type) {
+    for (i = 0; i < trace->num_ops; i++)
+        switch ((op = TRACE_OP(trace, i))->type) {
             case ALLOC: /* mm_malloc */
-                index = trace->ops[i].index;
-                size = trace->ops[i].size;
+                index = op->index;
+                size = op->size;
                 if ((p = mm_malloc(size)) == NULL)
                     app_error("mm_malloc error in eval_mm_speed");
                 trace->blocks[index] = p;
                 break;
 
             case REALLOC: /* mm_realloc */
-                index = trace->ops[i].index;
-                newsize = trace->ops[i].size;
+                index = op->index;
+                newsize = op->size;
                 oldp = trace->blocks[index];
                 if ((newp = mm_realloc(oldp, newsize)) == NULL)
                     app_error("mm_realloc error in eval_mm_speed");
@@ -778,7 +1142,7 @@ static void eval_mm_speed(void *ptr) {
                 break;
 
             case FREE: /* mm_free */
-                index = trace->ops[i].index;
+                index = op->index;
                 block = trace->blocks[index];
                 mm_free(block);
                 break;
@@ -788,6 +1152,98 @@ static void eval_mm_speed(void *ptr) {
         }
 }
 
+/*
+ * eval_mm_latency - Run the trace once more, reading the cycle counter
+ *    around every request. Records each request type's p50, p99, p99.9
+ *    and max cycles in stats, and adds the samples to lat_hist.
+ */
+static void eval_mm_latency(trace_t *trace, stats_t *stats) {
+    static double hist[LAT_TYPES][LAT_BUCKETS];
+    static const double pct[3] = {0.5, 0.99, 0.999};
+    traceop_t *op;
+    int i, j, b, type;
+    double cycles, seen;
+    char *p;
+
+    memset(hist, 0, sizeof(hist));
+    mem_reset_brk();
+    if (mm_init() < 0) app_error("mm_init failed in eval_mm_latency");
+
+    for (i = 0; i < trace->num_ops; i++) {
+        op = TRACE_OP(trace, i);
+        switch (op->type) {
+            case ALLOC: /* mm_malloc */
+                start_counter();
+                p = mm_malloc(op->size);
+                cycles = get_counter();
+                if (p == NULL) app_error("mm_malloc error in eval_mm_latency");
+                trace->blocks[op->index] = p;
+                break;
+
+            case REALLOC: /* mm_realloc */
+                start_counter();
+                p = mm_realloc(trace->blocks[op->index], op->size);
+                cycles = get_counter();
+                if (p == NULL) app_error("mm_realloc error in eval_mm_latency");
+                trace->blocks[op->index] = p;
+                break;
+
+            case FREE: /* mm_free */
+                start_counter();
+                mm_free(trace->blocks[op->index]);
+                cycles = get_counter();
+                break;
+
+            default:
+                app_error("Nonexistent request type in eval_mm_latency");
+        }
+
+        cycles -= lat_overhead;
+        type = op->type;
+        hist[type][lat_bucket(cycles)]++;
+        stats->lat_count[type]++;
+        if (cycles > stats->lat_pct[type][3]) stats->lat_pct[type][3] = cycles;
+    }
+
+    /* Percentiles are the upper bounds of the buckets that hold them */
+    for (type = 0; type < LAT_TYPES; type++) {
+        for (j = 0, b = 0, seen = 0; j < 3; j++) {
+            while (b < LAT_BUCKETS &&
+                   seen + hist[type][b] < pct[j] * stats->lat_count[type])
+                seen += hist[type][b++];
+            stats->lat_pct[type][j] = lat_bound(b);
+            if (stats->lat_pct[type][j] > stats->lat_pct[type][3])
+                stats->lat_pct[type][j] = stats->lat_pct[type][3];
+        }
+        for (b = 0; b < LAT_BUCKETS; b++) lat_hist[type][b] += hist[type][b];
+    }
+}
+
+/*
+ * lat_bucket - Histogram bucket for a cycle count: one bucket per cycle
+ *    below LAT_SUB, then LAT_SUB buckets per power of two
+ */
+static int lat_bucket(double cycles) {
+    unsigned long long c = cycles < 0 ? 0 : (unsigned long long)cycles;
+    int e;
+
+    if (c < LAT_SUB) return (int)c;
+    e = 63 - __builtin_clzll(c); /* c lies in [2^e, 2^(e+1)) */
+    return LAT_SUB + (e - 4) * LAT_SUB + (int)((c >> (e - 4)) - LAT_SUB);
+}
+
+/*
+ * lat_bound - Largest cycle count that falls in bucket b
+ */
+static double lat_bound(int b) {
+    int e;
+
+    if (b < LAT_SUB) return b;
+    e = (b - LAT_SUB) / LAT_SUB + 4;
+    return (double)(LAT_SUB + (b - LAT_SUB) % LAT_SUB + 1) * (1ULL << (e - 4)) -
+           1;
+}
+
 /*
  * eval_libc_valid - We run this function to make sure that the
  *    libc malloc can run to completion on the set of traces.
@@ -795,31 +1251,33 @@ static void eval_mm_speed(void *ptr) {
  *
  */
 static int eval_libc_valid(trace_t *trace, int tracenum) {
+    traceop_t *op;
     int i, newsize;
     char *p, *newp, *oldp;
 
     for (i = 0; i < trace->num_ops; i++) {
-        switch (trace->ops[i].type) {
+        op = TRACE_OP(trace, i);
+        switch (op->type) {
             case ALLOC: /* malloc */
-                if ((p = malloc(trace->ops[i].size)) == NULL) {
+                if ((p = malloc(op->size)) == NULL) {
                     malloc_error(tracenum, i, "libc malloc failed");
                     unix_error("System message");
                 }
-                trace->blocks[trace->ops[i].index] = p;
+                trace->blocks[op->index] = p;
                 break;
 
             case REALLOC: /* realloc */
-                newsize = trace->ops[i].size;
-                oldp = trace->blocks[trace->ops[i].index];
+                newsize = op->size;
+                oldp = trace->blocks[op->index];
                 if ((newp = realloc(oldp, newsize)) == NULL) {
                     malloc_error(tracenum, i, "libc realloc failed");
                     unix_error("System message");
                 }
-                trace->blocks[trace->ops[i].index] = newp;
+                trace->blocks[op->index] = newp;
                 break;
 
             case FREE: /* free */
-                free(trace->blocks[trace->ops[i].index]);
+                free(trace->blocks[op->index]);
                 break;
 
             default:
@@ -836,24 +1294,26 @@ static int eval_libc_valid(trace_t *trace, int tracenum) {
  *    of traces.
  */
 static void eval_libc_speed(void *ptr) {
+    traceop_t *op;
     int i;
     int index, size, newsize;
     char *p, *newp, *oldp, *block;
     trace_t *trace = ((speed_t *)ptr)->trace;
 
     for (i = 0; i < trace->num_ops; i++) {
-        switch (trace->ops[i].type) {
+        op = TRACE_OP(trace, i);
+        switch (op->type) {
             case ALLOC: /* malloc */
-                index = trace->ops[i].index;
-                size = trace->ops[i].size;
+                index = op->index;
+                size = op->size;
                 if ((p = malloc(size)) == NULL)
                     unix_error("malloc failed in eval_libc_speed");
                 trace->blocks[index] = p;
                 break;
 
             case REALLOC: /* realloc */
-                index = trace->ops[i].index;
-                newsize = trace->ops[i].size;
+                index = op->index;
+                newsize = op->size;
                 oldp = trace->blocks[index];
                 if ((newp = realloc(oldp, newsize)) == NULL)
                     unix_error("realloc failed in eval_libc_speed\n");
@@ -862,7 +1322,7 @@ static void eval_libc_speed(void *ptr) {
                 break;
 
             case FREE: /* free */
-                index = trace->ops[i].index;
+                index = op->index;
                 block = trace->blocks[index];
                 free(block);
                 break;
@@ -908,6 +1368,90 @@ static void printresults(int n, stats_t *stats) {
     }
 }
 
+/*
+ * printreallocs - prints how many reallocs of each trace were done in
+ * place, for the traces that have any
+ */
+static void printreallocs(int n, stats_t *stats) {
+    int i, header = 0;
+
+    for (i = 0; i < n; i++) {
+        if (!stats[i].valid || stats[i].reallocs == 0) continue;
+        if (!header) {
+            printf("\n%5s%10s%10s%16s\n", "trace", "reallocs", "in-place",
+                   "copy avoided");
+            header = 1;
+        }
+        printf("%2d%13.0f%9.1f%%%13.0f KB\n", i, stats[i].reallocs,
+               stats[i].inplace * 100.0 / stats[i].reallocs,
+               stats[i].copy_avoided / 1024);
+    }
+}
+
+/*
+ * printheap - prints the peak size of the heap plus mapped regions of each
+ * trace, the final heap size, how much of the final heap the allocator
+ * left resident, what it left mapped, and how many times it called
+ * mem_sbrk
+ */
+static void printheap(int n, stats_t *stats) {
+    int i;
+
+    printf("\n%5s%13s%13s%12s%10s%8s\n", "trace", "peak total", "final heap",
+           "resident", "mapped", "sbrks");
+    for (i = 0; i < n; i++) {
+        if (!stats[i].valid) continue;
+        printf("%2d%13.0f KB%10.0f KB%9.0f KB%7.0f KB%8.0f\n", i,
+               stats[i].peak_total / 1024, stats[i].final_heap / 1024,
+               stats[i].resident / 1024, stats[i].mapped / 1024,
+               stats[i].sbrks);
+    }
+}
+
+/*
+ * printlatency - prints the cycles taken by each request type of each
+ * trace, and a histogram over all traces with one row per power of two
+ */
+static void printlatency(int n, stats_t *stats) {
+    int i, type, b, e;
+    double row[LAT_TYPES], total;
+
+    printf("\nLatency in cycles (%.0f cycles of timer overhead subtracted)\n",
+           lat_overhead);
+    printf("%5s%9s%10s%8s%8s%8s%10s\n", "trace", "request", "count", "p50",
+           "p99", "p99.9", "max");
+    for (i = 0; i < n; i++) {
+        if (!stats[i].valid) continue;
+        for (type = 0; type < LAT_TYPES; type++) {
+            if (stats[i].lat_count[type] == 0) continue;
+            printf("%2d%12s%10.0f%8.0f%8.0f%8.0f%10.0f\n", i, lat_names[type],
+                   stats[i].lat_count[type], stats[i].lat_pct[type][0],
+                   stats[i].lat_pct[type][1], stats[i].lat_pct[type][2],
+                   stats[i].lat_pct[type][3]);
+        }
+    }
+
+    printf("\n%16s%10s%10s%10s\n", "cycles", lat_names[0], lat_names[1],
+           lat_names[2]);
+    for (e = 0, b = 0; b < LAT_BUCKETS; e++) {
+        /* Row e holds [2^e, 2^(e+1)) cycles, or [0, 2) for e = 0 */
+        for (type = 0, total = 0; type < LAT_TYPES; type++) row[type] = 0;
+        while (b < LAT_BUCKETS &&
+               (e == 63 || lat_bound(b) < (double)(1ULL << e) * 2)) {
+            for (type = 0; type < LAT_TYPES; type++) {
+                row[type] += lat_hist[type][b];
+                total += lat_hist[type][b];
+            }
+            b++;
+        }
+        if (total == 0) continue;
+        printf("%7.0f - %6.0f", e ? (double)(1ULL << e) : 0.0,
+               (double)(1ULL << e) * 2 - 1);
+        for (type = 0; type < LAT_TYPES; type++) printf("%10.0f", row[type]);
+        printf("\n");
+    }
+}
+
 /*
  * app_error - Report an arbitrary application error
  */
@@ -936,13 +1480,19 @@ void malloc_error(int tracenum, int opnum, char *msg) {
  * usage - Explain the command line arguments
  */
 static void usage(void) {
-    fprintf(stderr, "Usage: mdriver [-hvVal] [-f <file>] [-t <dir>]\n");
+    fprintf(stderr,
+            "Usage: mdriver [-hvValL] [-f <file>] [-t <dir>] [-M <MB>] "
+            "[-P <n>] [-j <n>]\n");
     fprintf(stderr, "Options\n");
     fprintf(stderr, "\t-a         Don't check the team structure.\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
     fprintf(stderr, "\t-g         Generate summary info for autograder.\n");
     fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-j <n>     Evaluate traces in <n> pinned worker processes.\n");
     fprintf(stderr, "\t-l         Run libc malloc as well.\n");
+    fprintf(stderr, "\t-L         Print per-request latency in cycles.\n");
+    fprintf(stderr, "\t-M <MB>    Maximum size of the simulated heap.\n");
+    fprintf(stderr, "\t-P <n>     Write a heap timeline per trace, every <n> requests.\n");
     fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
     fprintf(stderr, "\t-v         Print per-trace performance breakdowns.\n");
     fprintf(stderr, "\t-V         Print additional debug info.\n");
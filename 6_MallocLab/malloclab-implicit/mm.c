@@ -2,13 +2,27 @@
  * mm-implicit.c
  * 
  * This file refers to the code example /vm/malloc/mm.c, which uses explicit
- * list. You can choose between first-fit and next-fit by define/undefine the
- * macro NEXT_FIT. The result is as below.
+ * list. You can choose between first-fit and next-fit with the FIT setting
+ * (see below; "make sweep" compares them). The result is as below.
  * 
  * Observation: 
  * First-fit is much slower than next-fit, though achieveing slightly better
  * memory utilization. 
  * 
+ * Both were measured before mm_realloc learned to resize in place, and
+ * before the changes below; "make sweep" measures the current policies.
+ * 
+ * With TRIM_THRESHOLD and RELEASE_THRESHOLD set (both are off by default),
+ * mm_free gives memory back: a large free block at the end of the heap is
+ * cut back to TRIM_PAD bytes (negative mem_sbrk), and the pages inside
+ * any other large free block are released (mem_release). This costs
+ * throughput, because the driver has to fault the pages in again on each
+ * timed run.
+ * 
+ * The heap grows by the exact shortfall of a request that finds no fit,
+ * or geometrically from CHUNKSIZE during a burst of growth (grow_size),
+ * which needs fewer mem_sbrk calls than growing by a fixed 4 KB.
+ * 
  * first fit:
     $ ./mdriver -v
     Team Name:FastLearn
@@ -57,6 +71,7 @@
     Perf index = 44 (util) + 40 (thru) = 84/100
  */
 #include <assert.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -81,7 +96,23 @@ team_t team = {
     /* Second member's email address (leave blank if none) */
     ""};
 
+/*
+ * Build-time policy. Each setting can also be given on the compiler
+ * command line (-DFIT=0 -DCHUNKSIZE=512); "make sweep" builds and runs
+ * every combination listed in the Makefile.
+ *   FIT        0: first fit, 2: next fit (1, best fit, is explicit only)
+ *   CHUNKSIZE  first step of the heap's growth in a burst (see grow_size)
+ *   GROW_WINDOW, GROW_MAX  when and how far a burst grows (below)
+ *   TRIM_THRESHOLD, RELEASE_THRESHOLD  0: keep freed memory (below)
+ */
+#ifndef FIT
+#define FIT 2
+#endif
+#if FIT == 2
 #define NEXT_FIT
+#elif FIT != 0
+#error "FIT must be 0 (first fit) or 2 (next fit)"
+#endif
 
 /* single word (4) or double word (8) alignment */
 #define ALIGNMENT 8
@@ -95,9 +126,40 @@ team_t team = {
 
 #define WSIZE 4
 #define DSIZE 8
-#define CHUNKSIZE (1 << 12)
+#ifndef CHUNKSIZE
+#define CHUNKSIZE (1 << 9)
+#endif
+
+/* The heap grows by the exact shortfall of a request, unless it last grew
+ * at most GROW_WINDOW requests ago: then by CHUNKSIZE, doubling on each
+ * such extension up to GROW_MAX bytes. */
+#ifndef GROW_WINDOW
+#define GROW_WINDOW 64
+#endif
+#ifndef GROW_MAX
+#define GROW_MAX (1 << 14)
+#endif
+
+/* A free block at the end of the heap of at least TRIM_THRESHOLD bytes is
+ * cut back to TRIM_PAD bytes by shrinking the heap. The pages inside a
+ * free block of at least RELEASE_THRESHOLD bytes elsewhere are given back
+ * to the system. A threshold of 0 turns that off, which is the default.
+ * Try -DTRIM_THRESHOLD=131072 -DRELEASE_THRESHOLD=65536. */
+#ifndef TRIM_THRESHOLD
+#define TRIM_THRESHOLD 0
+#endif
+#ifndef TRIM_PAD
+#define TRIM_PAD (1 << 16)
+#endif
+#ifndef RELEASE_THRESHOLD
+#define RELEASE_THRESHOLD 0
+#endif
+#if TRIM_THRESHOLD && TRIM_THRESHOLD <= TRIM_PAD
+#error "TRIM_THRESHOLD must be larger than TRIM_PAD"
+#endif
 
 #define MAX(x, y) ((x) > (y) ? (x) : (y))
+#define MIN(x, y) ((x) < (y) ? (x) : (y))
 
 /* Pack a size and allocated bit into a word */
 #define PACK(size, alloc) ((size) | (alloc))
@@ -110,6 +172,10 @@ team_t team = {
 #define GET_SIZE(p) (GET(p) & ~0x7)
 #define GET_ALLOC(p) (GET(p) & 0x1)
 
+/* Set in an allocated block that mm_realloc has grown before */
+#define REALLOC_TAG 0x4
+#define GET_TAG(p) (GET(p) & REALLOC_TAG)
+
 /* Given block ptr bp, compute address of its header and footer */
 #define HDRP(bp) ((char *)(bp)-WSIZE)
 #define FTRP(bp) ((char *)(bp) + GET_SIZE(HDRP(bp)) - DSIZE)
@@ -122,11 +188,18 @@ static char *heap_listp = 0;
 #ifdef NEXT_FIT
 static char *rover; /* Next fit rover */
 #endif
+static size_t growth;          /* Current growth step, 0 if not in a burst */
+static unsigned long requests; /* mm_malloc calls ... */
+static unsigned long grown_at; /* ... and their number at the last growth */
 
 static void *extend_heap(size_t words);
+static size_t grow_size(size_t asize);
 static void place(void *bp, size_t asize);
 static void *find_fit(size_t asize);
 static void *coalesce(void *bp);
+static size_t adjust_size(size_t size);
+static void realloc_place(void *bp, size_t csize, size_t asize);
+static void trim_heap(void *bp);
 static void printblock(void *bp);
 static void checkheap(int verbose);
 static void checkblock(void *bp);
@@ -145,6 +218,8 @@ int mm_init(void) {
 #ifdef NEXT_FIT
     rover = heap_listp;
 #endif
+    growth = 0;
+    requests = grown_at = 0;
 
     if (extend_heap(CHUNKSIZE / WSIZE) == NULL)
         return -1;
@@ -171,6 +246,27 @@ static void *extend_heap(size_t words) {
     return coalesce(bp);
 }
 
+/*
+ * grow_size - Bytes to extend the heap by for a request of asize bytes
+ * that found no fit. A free block at the end of the heap merges with the
+ * new space, so only the rest is needed. In a burst (the heap grew only a
+ * few requests ago) the step doubles from CHUNKSIZE, so the burst takes a
+ * logarithmic number of mem_sbrk calls; otherwise the heap grows by the
+ * exact shortfall and does not end in unused space near its peak.
+ */
+static size_t grow_size(size_t asize) {
+    char *brk = (char *)mem_heap_hi() + 1;
+    size_t tail = GET_ALLOC(brk - DSIZE) ? 0 : GET_SIZE(brk - DSIZE);
+    size_t need = (tail < asize) ? asize - tail : asize;
+
+    if (requests - grown_at <= GROW_WINDOW)
+        growth = growth ? MIN(2 * growth, GROW_MAX) : CHUNKSIZE;
+    else
+        growth = 0;
+    grown_at = requests;
+    return MAX(need, growth);
+}
+
 static void *coalesce(void *bp) {
     size_t prev_alloc = GET_ALLOC(FTRP(PREV_BLKP(bp)));
     size_t next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(bp)));
@@ -231,21 +327,8 @@ void *mm_malloc(size_t size) {
     if (size == 0)
         return NULL;
 
-    /* Adjust block size to include overhead and alignment reqs. */
-    if (size <= DSIZE)
-        /**
-         * The minimum block size is 16 bytes: 8 bytes to satisfy the alignment 
-         * requirement, 8 more bytes for the header and footer.
-         */
-        asize = 2 * DSIZE;
-    else
-        asize = DSIZE * ((size + (DSIZE) + (DSIZE - 1)) / DSIZE);
-    /**
-         * For 8 < size <= 16, aszie = 3
-         * For k * DSIZE < size <= (k+1) * DSIZE, asize is the same.
-         * "The general rule is to add the overhead bytes and round to the nearest
-         * multiple of 8.". Overhead bytes = DSIZE.
-         */
+    requests++;
+    asize = adjust_size(size);
 
     /* Search the free list for a fit */
     if ((bp = find_fit(asize)) != NULL) {
@@ -254,13 +337,32 @@ void *mm_malloc(size_t size) {
     }
 
     /* No fit found. Get more memory and place the block */
-    extendsize = MAX(asize, CHUNKSIZE);
+    extendsize = grow_size(asize);
     if ((bp = extend_heap(extendsize / WSIZE)) == NULL)
         return NULL;
     place(bp, asize);
     return bp;
 }
 
+/*
+ * adjust_size - Adjust block size to include overhead and alignment reqs.
+ */
+static size_t adjust_size(size_t size) {
+    if (size <= DSIZE)
+        /**
+         * The minimum block size is 16 bytes: 8 bytes to satisfy the alignment 
+         * requirement, 8 more bytes for the header and footer.
+         */
+        return 2 * DSIZE;
+    /**
+     * For 8 < size <= 16, aszie = 3
+     * For k * DSIZE < size <= (k+1) * DSIZE, asize is the same.
+     * "The general rule is to add the overhead bytes and round to the nearest
+     * multiple of 8.". Overhead bytes = DSIZE.
+     */
+    return DSIZE * ((size + (DSIZE) + (DSIZE - 1)) / DSIZE);
+}
+
 static void place(void *bp, size_t asize) {
     size_t csize = GET_SIZE(HDRP(bp));
 
@@ -308,9 +410,14 @@ static void *find_fit(size_t asize) {
 #endif
 }
 /*
- * mm_free
+ * mm_free - Free a block. If that leaves a large free block, the heap is
+ * trimmed or the block's pages are released: those of the freed block,
+ * widened over any free neighbour too small to have been released itself.
  */
 void mm_free(void *bp) {
+    size_t prev, next;
+    char *lo, *hi, *fp;
+
     if (bp == 0)
         return;
 
@@ -319,16 +426,87 @@ void mm_free(void *bp) {
         mm_init();
     }
 
+    prev = GET_ALLOC(FTRP(PREV_BLKP(bp))) ? 0 : GET_SIZE((char *)bp - DSIZE);
+    next = GET_ALLOC(HDRP(NEXT_BLKP(bp))) ? 0 : GET_SIZE(HDRP(NEXT_BLKP(bp)));
+    lo = HDRP(bp);
+    hi = HDRP(bp) + size;
+
     PUT(HDRP(bp), PACK(size, 0));
     PUT(FTRP(bp), PACK(size, 0));
-    coalesce(bp);
+    fp = coalesce(bp);
+    size = GET_SIZE(HDRP(fp));
+
+    if (TRIM_THRESHOLD && size >= TRIM_THRESHOLD &&
+        GET_SIZE(HDRP(NEXT_BLKP(fp))) == 0) {
+        trim_heap(fp);
+    } else if (RELEASE_THRESHOLD && size >= RELEASE_THRESHOLD) {
+        if (prev && prev < RELEASE_THRESHOLD)
+            lo -= prev;
+        if (next && next < RELEASE_THRESHOLD)
+            hi += next;
+        lo = MAX(lo, fp);
+        hi = MIN(hi, FTRP(fp));
+        if (lo < hi)
+            mem_release(lo, hi - lo);
+    }
 }
 
 /*
- * mm_realloc - Implemented simply in terms of mm_malloc and mm_free
+ * trim_heap - Shrink the heap so that its last block, free block bp,
+ * keeps TRIM_PAD bytes.
+ */
+static void trim_heap(void *bp) {
+    size_t size = GET_SIZE(HDRP(bp)), step;
+
+    PUT(HDRP(bp), PACK(TRIM_PAD, 0));
+    PUT(FTRP(bp), PACK(TRIM_PAD, 0));
+    PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1)); /* New epilogue header */
+
+    /* mem_sbrk takes an int, so a tail of 2 GB or more goes in pieces */
+    for (size -= TRIM_PAD; size > 0; size -= step) {
+        step = MIN(size, (size_t)INT_MAX / DSIZE * DSIZE);
+        mem_sbrk(-(int)step);
+    }
+
+#ifdef NEXT_FIT
+    /* The rover may have been left at the old epilogue */
+    if (rover > (char *)bp)
+        rover = bp;
+#endif
+}
+
+/*
+ * realloc_place - Trim allocated block bp of size csize down to asize,
+ * freeing the tail if it can form a block of its own. The realloc tag is
+ * kept.
+ */
+static void realloc_place(void *bp, size_t csize, size_t asize) {
+    unsigned int tag = GET_TAG(HDRP(bp));
+
+    if ((csize - asize) >= (2 * DSIZE)) {
+        PUT(HDRP(bp), PACK(asize, 1 | tag));
+        PUT(FTRP(bp), PACK(asize, 1 | tag));
+        PUT(HDRP(NEXT_BLKP(bp)), PACK(csize - asize, 0));
+        PUT(FTRP(NEXT_BLKP(bp)), PACK(csize - asize, 0));
+        coalesce(NEXT_BLKP(bp));
+    } else {
+        PUT(HDRP(bp), PACK(csize, 1 | tag));
+        PUT(FTRP(bp), PACK(csize, 1 | tag));
+    }
+}
+
+/*
+ * mm_realloc - Resize in place when possible: shrink by splitting off the
+ * tail, grow into a free next block, or, for the last block on the heap,
+ * grow by extending the heap. Otherwise move the block.
+ *
+ * A block that has grown before (REALLOC_TAG) asks for half again the
+ * requested size, so repeated small growth rarely has to move it.
  */
 void *mm_realloc(void *ptr, size_t size) {
-    size_t oldsize;
+    size_t asize, want, csize, avail;
+    size_t wsize = size; /* Payload size asked for, with any slack */
+    char *next, *end;
     void *newptr;
 
     /* If size == 0 then this is just free, and we return NULL. */
@@ -342,17 +520,55 @@ void *mm_realloc(void *ptr, size_t size) {
         return mm_malloc(size);
     }
 
-    newptr = mm_malloc(size);
+    if (GET_TAG(HDRP(ptr)))
+        wsize += size / 2;
+    asize = adjust_size(size);
+    want = adjust_size(wsize);
+    csize = GET_SIZE(HDRP(ptr));
+
+    /* Shrink (or already big enough) */
+    if (asize <= csize) {
+        realloc_place(ptr, csize, MIN(want, csize));
+        return ptr;
+    }
+
+    next = NEXT_BLKP(ptr);
+    avail = csize;
+    if (!GET_ALLOC(HDRP(next)))
+        avail += GET_SIZE(HDRP(next));
+
+    /* Last block on the heap: extend the heap by what is missing */
+    end = GET_ALLOC(HDRP(next)) ? next : NEXT_BLKP(next);
+    if (avail < want && GET_SIZE(HDRP(end)) == 0) {
+        if (extend_heap(MAX(want - avail, 2 * DSIZE) / WSIZE) == NULL)
+            return NULL;
+        avail = csize + GET_SIZE(HDRP(next));
+    }
+
+    /* Grow into the free next block */
+    if (avail >= asize) {
+        PUT(HDRP(ptr), PACK(avail, 1 | REALLOC_TAG));
+        PUT(FTRP(ptr), PACK(avail, 1 | REALLOC_TAG));
+        realloc_place(ptr, avail, MIN(want, avail));
+#ifdef NEXT_FIT
+        /* The rover may have pointed at the absorbed block */
+        if ((rover > (char *)ptr) && (rover < NEXT_BLKP(ptr)))
+            rover = ptr;
+#endif
+        return ptr;
+    }
+
+    newptr = mm_malloc(wsize);
 
     /* If realloc() fails the original block is left untouched  */
     if (!newptr) {
         return 0;
     }
 
-    /* Copy the old data. */
-    oldsize = GET_SIZE(HDRP(ptr));
-    if (size < oldsize) oldsize = size;
-    memcpy(newptr, ptr, oldsize);
+    /* Copy the old data; the new block is larger. */
+    memcpy(newptr, ptr, csize - DSIZE);
+    PUT(HDRP(newptr), GET(HDRP(newptr)) | REALLOC_TAG);
+    PUT(FTRP(newptr), GET(FTRP(newptr)) | REALLOC_TAG);
 
     /* Free the old block. */
     mm_free(ptr);
@@ -360,6 +576,26 @@ void *mm_realloc(void *ptr, size_t size) {
     return newptr;
 }
 
+/*
+ * mm_freestats - Count the free blocks of the heap, their total size
+ * and the size of the largest, for mdriver's timeline (-P).
+ */
+void mm_freestats(size_t *count, size_t *total, size_t *largest) {
+    char *bp;
+    size_t size;
+
+    *count = *total = *largest = 0;
+    for (bp = heap_listp; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)) {
+        if (GET_ALLOC(HDRP(bp)))
+            continue;
+        size = GET_SIZE(HDRP(bp));
+        (*count)++;
+        *total += size;
+        if (size > *largest)
+            *largest = size;
+    }
+}
+
 static void printblock(void *bp) {
     size_t hsize, halloc, fsize, falloc;
 
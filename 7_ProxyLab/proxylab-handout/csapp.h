@@ -15,6 +15,7 @@
 #include <signal.h>
 #include <dirent.h>
 #include <sys/time.h>
+#include <time.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <sys/stat.h>
@@ -157,6 +158,15 @@ void Inet_pton(int af, const char *src, void *dst);
 struct hostent *Gethostbyname(const char *name);
 struct hostent *Gethostbyaddr(const char *addr, int len, int type);
 
+/* Thread-safe replacements for non-reentrant helpers */
+char *Ctime(const time_t *timep);
+int Rand(void);
+void Srand(unsigned int seed);
+int getnameinfo_cached(const struct sockaddr *sa, socklen_t salen, char *host,
+                       size_t hostlen, char *serv, size_t servlen, int flags);
+void Getnameinfo_cached(const struct sockaddr *sa, socklen_t salen, char *host,
+                        size_t hostlen, char *serv, size_t servlen, int flags);
+
 /* Pthreads thread control wrappers */
 void Pthread_create(pthread_t *tidp, pthread_attr_t *attrp, 
 		    void * (*routine)(void *), void *argp);
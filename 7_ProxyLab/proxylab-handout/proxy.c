@@ -140,9 +140,9 @@ int main(int argc, char **argv) {
         /* proxy_clientfd: used by proxy to serve client */
         proxy_clientfd_p = malloc(sizeof(int));
         *proxy_clientfd_p = Accept(listenfd, (SA *)&clientaddr, &clientlen);
-        Getnameinfo((SA *)&clientaddr, clientlen,
-                    client_hostname, MAXLINE,
-                    client_port, MAXLINE, 0);
+        Getnameinfo_cached((SA *)&clientaddr, clientlen,
+                           client_hostname, MAXLINE,
+                           client_port, MAXLINE, NI_NUMERICSERV);
         printf("Connected to (%s, %s)\n", client_hostname, client_port);
 
         /* Update time */
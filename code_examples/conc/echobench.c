@@ -0,0 +1,194 @@
+/*
+ * echobench.c - Load generator for the echo servers
+ *
+ * Opens <nconns> connections to an echo server, of which <nactive>
+ * repeatedly send a <msgsize>-byte text line and wait for it to be
+ * echoed back (one message in flight per connection). The rest are
+ * left idle, which models many mostly-quiet clients. After <secs>
+ * seconds it reports the number of round trips per second.
+ *
+ * Active connections are spread over <nthreads> client threads, each
+ * running its own epoll loop, so the client is not the bottleneck.
+ * Works against any of the echo servers in this directory:
+ *   echoservers.c  (select, at most FD_SETSIZE clients)
+ *   echoserverp.c  (process per client)
+ *   echoservert.c  (thread per client)
+ *   echoservere.c  (epoll + SO_REUSEPORT)
+ *
+ * Example:
+ *   linux> gcc -O2 -I../include -o echobench echobench.c ../src/csapp.c -lpthread
+ *   linux> ./echobench localhost 15213 10000 100 10 4
+ *
+ * Note: one client address can open at most ~28k connections to a
+ * given server port (the ephemeral port range); to test 100k idle
+ * clients, widen net.ipv4.ip_local_port_range or run several clients.
+ */
+#include "csapp.h"
+#include <sys/epoll.h>
+#include <sys/resource.h>
+
+#define MAXEVENTS 256
+
+typedef struct {         /* One active connection */
+    int fd;
+    size_t sent;         /* Bytes of the current message written */
+    size_t rcvd;         /* Bytes of the current echo read back */
+} bconn_t;
+
+typedef struct {         /* Arguments and results of one client thread */
+    char *host, *port;
+    int nconns;          /* Active connections owned by this thread */
+    volatile long msgs;  /* Completed round trips */
+} bthread_t;
+
+static size_t msgsize = 64;
+static char *msg;
+static volatile int done = 0;
+
+void *client_thread(void *vargp);
+static int send_msg(bconn_t *c);
+
+int main(int argc, char **argv)
+{
+    int i, nconns, nactive, secs, nthreads = 1, *idlefds;
+    long total = 0;
+    struct rlimit rl;
+    pthread_t *tid;
+    bthread_t *bt;
+
+    if (argc < 6 || argc > 8) {
+	fprintf(stderr, "usage: %s <host> <port> <nconns> <nactive> <secs> "
+		"[nthreads] [msgsize]\n", argv[0]);
+	exit(0);
+    }
+    nconns = atoi(argv[3]);
+    nactive = atoi(argv[4]);
+    secs = atoi(argv[5]);
+    if (argc > 6)
+	nthreads = atoi(argv[6]);
+    if (argc > 7)
+	msgsize = atoi(argv[7]);
+    if (nactive > nconns || nthreads <= 0 || msgsize < 2 || msgsize > MAXBUF)
+	app_error("bad arguments");
+
+    /* Need one descriptor per connection */
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+	rl.rlim_cur = rl.rlim_max;
+	setrlimit(RLIMIT_NOFILE, &rl);
+    }
+    Signal(SIGPIPE, SIG_IGN);
+
+    /* Every message is a line so that line-oriented servers echo it */
+    msg = Malloc(msgsize);
+    memset(msg, 'x', msgsize - 1);
+    msg[msgsize - 1] = '\n';
+
+    /* Open the idle connections first; they only hold descriptors */
+    idlefds = Malloc((nconns - nactive + 1) * sizeof(int));
+    for (i = 0; i < nconns - nactive; i++)
+	idlefds[i] = Open_clientfd(argv[1], argv[2]);
+    printf("%d idle connections open\n", nconns - nactive);
+
+    tid = Malloc(nthreads * sizeof(pthread_t));
+    bt = Calloc(nthreads, sizeof(bthread_t));
+    for (i = 0; i < nthreads; i++) {
+	bt[i].host = argv[1];
+	bt[i].port = argv[2];
+	bt[i].nconns = nactive / nthreads + (i < nactive % nthreads);
+	Pthread_create(&tid[i], NULL, client_thread, &bt[i]);
+    }
+
+    Sleep(secs);
+    done = 1;
+    for (i = 0; i < nthreads; i++) {
+	Pthread_join(tid[i], NULL);
+	total += bt[i].msgs;
+    }
+
+    printf("%d conns (%d active), %d threads, %lu-byte msgs: "
+	   "%ld msgs in %d s = %.0f msgs/sec\n",
+	   nconns, nactive, nthreads, (unsigned long)msgsize,
+	   total, secs, (double)total / secs);
+
+    for (i = 0; i < nconns - nactive; i++)
+	Close(idlefds[i]);
+    exit(0);
+}
+
+/* Thread routine: drive bt->nconns ping-pong connections */
+void *client_thread(void *vargp)
+{
+    bthread_t *bt = vargp;
+    int i, n, epfd;
+    char buf[MAXBUF];
+    struct epoll_event ev, events[MAXEVENTS];
+    bconn_t *conns;
+
+    if ((epfd = epoll_create1(0)) < 0)
+	unix_error("epoll_create1 error");
+    conns = Calloc(bt->nconns + 1, sizeof(bconn_t));
+
+    for (i = 0; i < bt->nconns; i++) {
+	bconn_t *c = &conns[i];
+	c->fd = Open_clientfd(bt->host, bt->port);
+	fcntl(c->fd, F_SETFL, fcntl(c->fd, F_GETFL) | O_NONBLOCK);
+	ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+	ev.data.ptr = c;
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, c->fd, &ev) < 0)
+	    unix_error("epoll_ctl error");
+    }
+
+    while (!done) {
+	if ((n = epoll_wait(epfd, events, MAXEVENTS, 100)) < 0) {
+	    if (errno == EINTR)
+		continue;
+	    unix_error("epoll_wait error");
+	}
+	for (i = 0; i < n; i++) {
+	    bconn_t *c = events[i].data.ptr;
+	    ssize_t m;
+
+	    /* Finish writing the current message */
+	    if (send_msg(c) < 0)
+		app_error("echobench: write failed");
+
+	    /* Drain the echo; a complete echo starts the next message */
+	    while ((m = read(c->fd, buf, sizeof(buf))) > 0) {
+		c->rcvd += m;
+		while (c->rcvd >= msgsize) {
+		    c->rcvd -= msgsize;
+		    bt->msgs++;
+		    c->sent = 0;
+		    if (send_msg(c) < 0)
+			app_error("echobench: write failed");
+		}
+	    }
+	    if (m == 0)
+		app_error("echobench: server closed connection");
+	}
+    }
+
+    for (i = 0; i < bt->nconns; i++)
+	Close(conns[i].fd);
+    Close(epfd);
+    Free(conns);
+    return NULL;
+}
+
+/* send_msg - Write as much of the current message as the socket takes */
+static int send_msg(bconn_t *c)
+{
+    ssize_t m;
+
+    while (c->sent < msgsize) {
+	if ((m = write(c->fd, msg + c->sent, msgsize - c->sent)) > 0)
+	    c->sent += m;
+	else if (m < 0 && errno == EINTR)
+	    continue;
+	else if (m < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+	    return 0;
+	else
+	    return -1;
+    }
+    return 0;
+}
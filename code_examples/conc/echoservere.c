@@ -0,0 +1,322 @@
+/*
+ * echoservere.c - A scalable concurrent echo server based on epoll
+ *
+ * Each of NTHREADS worker threads opens its own listening socket on
+ * the same port with SO_REUSEPORT, so the kernel load-balances incoming
+ * connections across threads and no two threads ever share a
+ * descriptor. Every thread then runs an edge-triggered epoll event
+ * loop over its own clients. Unlike echoservers.c, a wakeup only
+ * touches the descriptors that are actually ready, and the number of
+ * clients is limited only by RLIMIT_NOFILE, not by FD_SETSIZE.
+ *
+ * Per-client state is a small heap-allocated conn_t that is only
+ * given an output buffer when a write would block, so idle clients
+ * cost a few dozen bytes each (100k idle connections fit in a few MB).
+ *
+ * Example:
+ *   linux> gcc -O2 -I../include -o echoservere echoservere.c ../src/csapp.c -lpthread
+ *   linux> ./echoservere 15213 4
+ */
+/* $begin echoserveremain */
+#include "csapp.h"
+#include <sys/epoll.h>
+#include <sys/resource.h>
+
+#define NTHREADS  4    /* Default number of event loop threads */
+#define MAXEVENTS 256  /* Max events returned by one epoll_wait */
+#define VERBOSE   0    /* If set, print a line per read like echo_cnt */
+
+typedef struct {       /* Represents one connected client */
+    int fd;            /* Connected descriptor */
+    char *outbuf;      /* Bytes still to be echoed, or NULL if none */
+    size_t outlen;     /* Number of valid bytes in outbuf */
+    size_t outoff;     /* Offset of first unsent byte in outbuf */
+} conn_t;
+
+static long byte_cnt = 0; /* Counts total bytes received by server */
+
+int open_listenfd_reuseport(char *port);
+void *event_loop(void *vargp);
+static void accept_clients(int epfd, int listenfd, int *sparefd);
+static int echo_client(int epfd, conn_t *c);
+static int flush_client(int epfd, conn_t *c);
+static void close_client(conn_t *c);
+static void raise_nofile_limit(void);
+
+int main(int argc, char **argv)
+{
+    int i, nthreads = NTHREADS;
+    pthread_t *tid;
+
+    if (argc != 2 && argc != 3) {
+	fprintf(stderr, "usage: %s <port> [nthreads]\n", argv[0]);
+	exit(0);
+    }
+    if (argc == 3 && (nthreads = atoi(argv[2])) <= 0)
+	app_error("nthreads must be positive");
+
+    raise_nofile_limit();
+    Signal(SIGPIPE, SIG_IGN); /* Peers that vanish must not kill us */
+
+    tid = Malloc(nthreads * sizeof(pthread_t));
+    for (i = 0; i < nthreads; i++)
+	Pthread_create(&tid[i], NULL, event_loop, argv[1]);
+    for (i = 0; i < nthreads; i++)
+	Pthread_join(tid[i], NULL);
+    exit(0);
+}
+
+/* Thread routine: run one edge-triggered event loop on a private listener */
+void *event_loop(void *vargp)
+{
+    int i, n, epfd, listenfd, sparefd;
+    struct epoll_event ev, events[MAXEVENTS];
+    conn_t *c;
+
+    if ((listenfd = open_listenfd_reuseport((char *)vargp)) < 0)
+	unix_error("open_listenfd_reuseport error");
+    sparefd = Open("/dev/null", O_RDONLY, 0); /* See accept_clients */
+    if ((epfd = epoll_create1(0)) < 0)
+	unix_error("epoll_create1 error");
+
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.ptr = NULL; /* NULL marks the listening descriptor */
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, listenfd, &ev) < 0)
+	unix_error("epoll_ctl error");
+
+    while (1) {
+	if ((n = epoll_wait(epfd, events, MAXEVENTS, -1)) < 0) {
+	    if (errno == EINTR)
+		continue;
+	    unix_error("epoll_wait error");
+	}
+
+	for (i = 0; i < n; i++) {
+	    if ((c = events[i].data.ptr) == NULL) {
+		accept_clients(epfd, listenfd, &sparefd);
+		continue;
+	    }
+	    if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+		close_client(c);
+		continue;
+	    }
+	    if ((events[i].events & EPOLLOUT) && flush_client(epfd, c) < 0)
+		continue;
+	    if ((events[i].events & (EPOLLIN | EPOLLRDHUP)) && c->outbuf == NULL)
+		echo_client(epfd, c);
+	}
+    }
+    return NULL;
+}
+/* $end echoserveremain */
+
+/*
+ * accept_clients - Edge-triggered, so drain the accept queue completely.
+ *     Out of descriptors (EMFILE or ENFILE), a pending connection would
+ *     stay queued with no new edge to report it, and the listener would
+ *     stall until the next client arrived. Instead, *sparefd, held open
+ *     for just this, is closed to accept the client and drop it at once,
+ *     then reopened.
+ */
+static void accept_clients(int epfd, int listenfd, int *sparefd)
+{
+    int connfd;
+    struct epoll_event ev;
+    conn_t *c;
+
+    while (1) {
+	if ((connfd = accept(listenfd, NULL, NULL)) < 0) {
+	    if (errno == EINTR || errno == ECONNABORTED)
+		continue;
+	    if ((errno == EMFILE || errno == ENFILE) && *sparefd >= 0) {
+		/* accept fails this way even on an empty queue, so stop
+		 * once the descriptor freed by the spare finds no client */
+		close(*sparefd);
+		if ((connfd = accept(listenfd, NULL, NULL)) >= 0)
+		    close(connfd);
+		*sparefd = open("/dev/null", O_RDONLY);
+		if (connfd < 0)
+		    return;
+		if (VERBOSE)
+		    printf("out of descriptors, dropped a client\n");
+		continue;
+	    }
+	    if (errno != EAGAIN && errno != EWOULDBLOCK)
+		fprintf(stderr, "accept error: %s\n", strerror(errno));
+	    return;
+	}
+
+	fcntl(connfd, F_SETFL, fcntl(connfd, F_GETFL) | O_NONBLOCK);
+	c = Malloc(sizeof(conn_t));
+	c->fd = connfd;
+	c->outbuf = NULL;
+	c->outlen = c->outoff = 0;
+
+	ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+	ev.data.ptr = c;
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, connfd, &ev) < 0) {
+	    fprintf(stderr, "epoll_ctl error: %s\n", strerror(errno));
+	    close_client(c);
+	}
+    }
+}
+
+/*
+ * echo_client - Read until the socket is drained and echo every byte.
+ *     If the peer stops reading, park the unsent bytes in outbuf and
+ *     wait for EPOLLOUT before reading any more from this client.
+ *     Returns -1 if the client was closed, 0 otherwise.
+ */
+static int echo_client(int epfd, conn_t *c)
+{
+    char buf[MAXBUF];
+    ssize_t n, sent;
+    struct epoll_event ev;
+    long total;
+
+    while (1) {
+	if ((n = read(c->fd, buf, MAXBUF)) == 0) { /* EOF */
+	    close_client(c);
+	    return -1;
+	}
+	if (n < 0) {
+	    if (errno == EINTR)
+		continue;
+	    if (errno == EAGAIN || errno == EWOULDBLOCK)
+		return 0;
+	    close_client(c);
+	    return -1;
+	}
+
+	total = __sync_add_and_fetch(&byte_cnt, n);
+	if (VERBOSE)
+	    printf("server received %d (%ld total) bytes on fd %d\n",
+		   (int)n, total, c->fd);
+
+	for (sent = 0; sent < n; ) {
+	    ssize_t m = write(c->fd, buf + sent, n - sent);
+	    if (m > 0) {
+		sent += m;
+		continue;
+	    }
+	    if (m < 0 && errno == EINTR)
+		continue;
+	    if (m < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+		/* Socket buffer full: save the rest, ask for EPOLLOUT */
+		c->outlen = n - sent;
+		c->outoff = 0;
+		c->outbuf = Malloc(c->outlen);
+		memcpy(c->outbuf, buf + sent, c->outlen);
+		ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+		ev.data.ptr = c;
+		if (epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev) < 0) {
+		    close_client(c);
+		    return -1;
+		}
+		return 0;
+	    }
+	    close_client(c);
+	    return -1;
+	}
+    }
+}
+
+/*
+ * flush_client - Send parked output. Once it is all gone, stop
+ *     watching for EPOLLOUT and resume echoing whatever arrived in the
+ *     meantime. Returns -1 if the client was closed, 0 otherwise.
+ */
+static int flush_client(int epfd, conn_t *c)
+{
+    ssize_t m;
+    struct epoll_event ev;
+
+    while (c->outoff < c->outlen) {
+	m = write(c->fd, c->outbuf + c->outoff, c->outlen - c->outoff);
+	if (m > 0) {
+	    c->outoff += m;
+	    continue;
+	}
+	if (m < 0 && errno == EINTR)
+	    continue;
+	if (m < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+	    return 0;
+	close_client(c);
+	return -1;
+    }
+
+    Free(c->outbuf);
+    c->outbuf = NULL;
+    c->outlen = c->outoff = 0;
+    ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+    ev.data.ptr = c;
+    if (epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev) < 0) {
+	close_client(c);
+	return -1;
+    }
+    return echo_client(epfd, c);
+}
+
+/* close_client - Closing the fd also removes it from the epoll set */
+static void close_client(conn_t *c)
+{
+    Close(c->fd);
+    if (c->outbuf)
+	Free(c->outbuf);
+    Free(c);
+}
+
+/*
+ * open_listenfd_reuseport - Like open_listenfd, but nonblocking and
+ *     with SO_REUSEPORT set so that every thread can bind the same port.
+ *     Returns -2 for getaddrinfo error, -1 with errno set otherwise.
+ */
+int open_listenfd_reuseport(char *port)
+{
+    struct addrinfo hints, *listp, *p;
+    int listenfd, rc, optval = 1;
+
+    memset(&hints, 0, sizeof(struct addrinfo));
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE | AI_ADDRCONFIG | AI_NUMERICSERV;
+    if ((rc = getaddrinfo(NULL, port, &hints, &listp)) != 0) {
+	fprintf(stderr, "getaddrinfo failed (port %s): %s\n", port, gai_strerror(rc));
+	return -2;
+    }
+
+    for (p = listp; p; p = p->ai_next) {
+	if ((listenfd = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) < 0)
+	    continue;
+	setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR,
+		   (const void *)&optval, sizeof(int));
+	setsockopt(listenfd, SOL_SOCKET, SO_REUSEPORT,
+		   (const void *)&optval, sizeof(int));
+	if (bind(listenfd, p->ai_addr, p->ai_addrlen) == 0)
+	    break;
+	close(listenfd);
+    }
+
+    freeaddrinfo(listp);
+    if (!p)
+	return -1;
+
+    /* A long accept queue absorbs connection storms from the benchmark */
+    if (listen(listenfd, 4096) < 0) {
+	close(listenfd);
+	return -1;
+    }
+    fcntl(listenfd, F_SETFL, fcntl(listenfd, F_GETFL) | O_NONBLOCK);
+    return listenfd;
+}
+
+/* raise_nofile_limit - Allow as many descriptors as the hard limit permits */
+static void raise_nofile_limit(void)
+{
+    struct rlimit rl;
+
+    if (getrlimit(RLIMIT_NOFILE, &rl) < 0)
+	unix_error("getrlimit error");
+    rl.rlim_cur = rl.rlim_max;
+    if (setrlimit(RLIMIT_NOFILE, &rl) < 0)
+	unix_error("setrlimit error");
+}
@@ -0,0 +1,212 @@
+/*
+ * lfsbuf.c - A lock-free bounded MPMC buffer, a drop-in for sbuf.c
+ *
+ * Every cell carries a sequence number. A cell at ring position pos is
+ * free for the producer that claims pos when seq == pos, and holds an
+ * item for the consumer that claims pos when seq == pos + 1. Claiming
+ * a position is a single CAS on rear (producers) or front (consumers);
+ * publishing is a release store of the cell's seq. No thread ever waits
+ * for another thread to finish an operation unless the ring is full or
+ * empty, in which case it sleeps on a futex instead of spinning.
+ *
+ * Sleeping without lost wakeups: a sleeper reads the event word, then
+ * announces itself in the waiter count, then retries the ring once more
+ * before calling FUTEX_WAIT with the value it read. A waker publishes
+ * its item (or slot), issues a full fence, and only then reads the
+ * waiter count. Either the sleeper's retry sees the new item, or the
+ * waker sees the sleeper and bumps the event word, which makes the
+ * FUTEX_WAIT return at once.
+ *
+ * Linux only (futex). Compile with the other conc examples, e.g.
+ *   linux> gcc -O2 -I../include -c lfsbuf.c
+ */
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include "csapp.h"
+#include "lfsbuf.h"
+
+#define LOAD(p, mo)      __atomic_load_n((p), (mo))
+#define STORE(p, v, mo)  __atomic_store_n((p), (v), (mo))
+#define CAS(p, e, d)     __atomic_compare_exchange_n((p), (e), (d), 1, \
+                             __ATOMIC_RELAXED, __ATOMIC_RELAXED)
+
+static void futex_wait(unsigned int *addr, unsigned int val)
+{
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+static void futex_wake(unsigned int *addr, int nwake)
+{
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, nwake, NULL, NULL, 0);
+}
+
+/* Create an empty, bounded, shared FIFO buffer with at least n slots */
+void lfsbuf_init(lfsbuf_t *sp, int n)
+{
+    unsigned long i, size = 2;
+
+    while (size < (unsigned long)n)  /* Round up to a power of two */
+	size <<= 1;
+    sp->buf = Calloc(size, sizeof(lfsbuf_cell_t));
+    for (i = 0; i < size; i++)
+	sp->buf[i].seq = i;          /* Cell i is free for position i */
+    sp->mask = size - 1;
+    sp->n = (int)size;
+    sp->front = sp->rear = 0;        /* Empty buffer iff front == rear */
+    sp->items_ev = sp->slots_ev = 0;
+    sp->items_waiters = sp->slots_waiters = 0;
+}
+
+/* Clean up buffer sp */
+void lfsbuf_deinit(lfsbuf_t *sp)
+{
+    Free(sp->buf);
+}
+
+/* try_insert - Insert item unless the buffer is full. Returns 1 on success */
+static int try_insert(lfsbuf_t *sp, int item)
+{
+    lfsbuf_cell_t *cell;
+    unsigned long pos = LOAD(&sp->rear, __ATOMIC_RELAXED);
+    long dif;
+
+    while (1) {
+	cell = &sp->buf[pos & sp->mask];
+	dif = (long)(LOAD(&cell->seq, __ATOMIC_ACQUIRE) - pos);
+	if (dif == 0) {
+	    if (CAS(&sp->rear, &pos, pos + 1))
+		break;                       /* pos reloaded on failure */
+	} else if (dif < 0) {
+	    return 0;                        /* Cell still holds an old item */
+	} else {
+	    pos = LOAD(&sp->rear, __ATOMIC_RELAXED);
+	}
+    }
+    cell->item = item;
+    STORE(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+/* try_remove - Remove an item unless the buffer is empty. Returns 1 on success */
+static int try_remove(lfsbuf_t *sp, int *itemp)
+{
+    lfsbuf_cell_t *cell;
+    unsigned long pos = LOAD(&sp->front, __ATOMIC_RELAXED);
+    long dif;
+
+    while (1) {
+	cell = &sp->buf[pos & sp->mask];
+	dif = (long)(LOAD(&cell->seq, __ATOMIC_ACQUIRE) - (pos + 1));
+	if (dif == 0) {
+	    if (CAS(&sp->front, &pos, pos + 1))
+		break;
+	} else if (dif < 0) {
+	    return 0;                        /* Cell not yet filled */
+	} else {
+	    pos = LOAD(&sp->front, __ATOMIC_RELAXED);
+	}
+    }
+    *itemp = cell->item;
+    STORE(&cell->seq, pos + sp->mask + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+/* announce - Wake up to nwake sleepers on ev if there are any */
+static void announce(unsigned int *ev, int *waiters, int nwake)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (LOAD(waiters, __ATOMIC_SEQ_CST) > 0) {
+	__atomic_add_fetch(ev, 1, __ATOMIC_SEQ_CST);
+	futex_wake(ev, nwake);
+    }
+}
+
+/* Insert item onto the rear of shared buffer sp */
+void lfsbuf_insert(lfsbuf_t *sp, int item)
+{
+    unsigned int ev;
+
+    while (!try_insert(sp, item)) {          /* Wait for available slot */
+	ev = LOAD(&sp->slots_ev, __ATOMIC_SEQ_CST);
+	__atomic_add_fetch(&sp->slots_waiters, 1, __ATOMIC_SEQ_CST);
+	if (try_insert(sp, item)) {
+	    __atomic_sub_fetch(&sp->slots_waiters, 1, __ATOMIC_SEQ_CST);
+	    break;
+	}
+	futex_wait(&sp->slots_ev, ev);
+	__atomic_sub_fetch(&sp->slots_waiters, 1, __ATOMIC_SEQ_CST);
+    }
+    announce(&sp->items_ev, &sp->items_waiters, 1); /* Announce available item */
+}
+
+/* Remove and return the first item from buffer sp */
+int lfsbuf_remove(lfsbuf_t *sp)
+{
+    int item;
+    unsigned int ev;
+
+    while (!try_remove(sp, &item)) {         /* Wait for available item */
+	ev = LOAD(&sp->items_ev, __ATOMIC_SEQ_CST);
+	__atomic_add_fetch(&sp->items_waiters, 1, __ATOMIC_SEQ_CST);
+	if (try_remove(sp, &item)) {
+	    __atomic_sub_fetch(&sp->items_waiters, 1, __ATOMIC_SEQ_CST);
+	    break;
+	}
+	futex_wait(&sp->items_ev, ev);
+	__atomic_sub_fetch(&sp->items_waiters, 1, __ATOMIC_SEQ_CST);
+    }
+    announce(&sp->slots_ev, &sp->slots_waiters, 1); /* Announce available slot */
+    return item;
+}
+
+/*
+ * lfsbuf_insert_batch - Insert cnt items in order, blocking while full.
+ *     Consumers are woken once per batch (or before blocking) rather
+ *     than once per item, which saves a fence and a syscall per item.
+ */
+void lfsbuf_insert_batch(lfsbuf_t *sp, const int *items, int cnt)
+{
+    int i = 0, pending = 0;
+    unsigned int ev;
+
+    while (i < cnt) {
+	if (try_insert(sp, items[i])) {
+	    i++;
+	    pending++;
+	    continue;
+	}
+	/* Full: let consumers drain what we already inserted, then sleep */
+	if (pending) {
+	    announce(&sp->items_ev, &sp->items_waiters, pending);
+	    pending = 0;
+	}
+	ev = LOAD(&sp->slots_ev, __ATOMIC_SEQ_CST);
+	__atomic_add_fetch(&sp->slots_waiters, 1, __ATOMIC_SEQ_CST);
+	if (!try_insert(sp, items[i]))
+	    futex_wait(&sp->slots_ev, ev);
+	else {
+	    i++;
+	    pending++;
+	}
+	__atomic_sub_fetch(&sp->slots_waiters, 1, __ATOMIC_SEQ_CST);
+    }
+    if (pending)
+	announce(&sp->items_ev, &sp->items_waiters, pending);
+}
+
+/*
+ * lfsbuf_remove_batch - Remove up to maxcnt items into items[]. Blocks
+ *     only until at least one item is available and returns the number
+ *     of items removed (always >= 1).
+ */
+int lfsbuf_remove_batch(lfsbuf_t *sp, int *items, int maxcnt)
+{
+    int cnt;
+
+    items[0] = lfsbuf_remove(sp);
+    for (cnt = 1; cnt < maxcnt && try_remove(sp, &items[cnt]); cnt++)
+	;
+    if (cnt > 1)
+	announce(&sp->slots_ev, &sp->slots_waiters, cnt - 1);
+    return cnt;
+}
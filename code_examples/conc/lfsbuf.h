@@ -0,0 +1,44 @@
+#ifndef __LFSBUF_H__
+#define __LFSBUF_H__
+
+#include "csapp.h"
+
+#define LFSBUF_LINE 64  /* Cache line size, used to keep hot fields apart */
+
+/*
+ * A bounded multi-producer/multi-consumer FIFO with the same interface
+ * and semantics as sbuf_t, built on a sequence-numbered ring in the style
+ * of Dmitry Vyukov's MPMC queue. The fast path is one CAS per insert or
+ * remove and never sleeps; a thread only falls back to a futex when the
+ * buffer is full (producers) or empty (consumers).
+ */
+typedef struct {
+    unsigned long seq;  /* Ring position this cell is ready for */
+    int item;           /* Payload */
+} lfsbuf_cell_t;
+
+typedef struct {
+    lfsbuf_cell_t *buf;   /* Ring of cells, n is a power of two */
+    unsigned long mask;   /* n - 1 */
+    int n;                /* Maximum number of slots */
+
+    /* Each cursor sits on its own cache line so that producers and
+       consumers do not invalidate each other's lines */
+    unsigned long rear  __attribute__((aligned(LFSBUF_LINE)));  /* Next insert position */
+    unsigned long front __attribute__((aligned(LFSBUF_LINE)));  /* Next remove position */
+
+    /* Futex words, bumped to wake sleepers, and sleeper counts */
+    unsigned int items_ev __attribute__((aligned(LFSBUF_LINE)));
+    int items_waiters;
+    unsigned int slots_ev __attribute__((aligned(LFSBUF_LINE)));
+    int slots_waiters;
+} lfsbuf_t;
+
+void lfsbuf_init(lfsbuf_t *sp, int n);
+void lfsbuf_deinit(lfsbuf_t *sp);
+void lfsbuf_insert(lfsbuf_t *sp, int item);
+int lfsbuf_remove(lfsbuf_t *sp);
+void lfsbuf_insert_batch(lfsbuf_t *sp, const int *items, int cnt);
+int lfsbuf_remove_batch(lfsbuf_t *sp, int *items, int maxcnt);
+
+#endif /* __LFSBUF_H__ */
@@ -0,0 +1,41 @@
+/*
+ * pcount.c - Cache-line padded per-thread accumulator
+ */
+#include "csapp.h"
+#include "pcount.h"
+
+/* Create an accumulator with nslots zeroed slots */
+void pcount_init(pcount_t *cp, int nslots)
+{
+    if (posix_memalign((void **)&cp->slots, PCOUNT_LINE,
+		       nslots * sizeof(pcount_slot_t)) != 0)
+	unix_error("pcount_init: posix_memalign error");
+    cp->nslots = nslots;
+    pcount_reset(cp);
+}
+
+/* Clean up accumulator cp */
+void pcount_deinit(pcount_t *cp)
+{
+    free(cp->slots);
+}
+
+/* Combining read: the sum of all slots */
+long pcount_read(pcount_t *cp)
+{
+    long sum = 0;
+    int i;
+
+    for (i = 0; i < cp->nslots; i++)
+	sum += __atomic_load_n(&cp->slots[i].val, __ATOMIC_RELAXED);
+    return sum;
+}
+
+/* Zero every slot. Not safe against concurrent pcount_add */
+void pcount_reset(pcount_t *cp)
+{
+    int i;
+
+    for (i = 0; i < cp->nslots; i++)
+	cp->slots[i].val = 0;
+}
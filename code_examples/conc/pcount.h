@@ -0,0 +1,37 @@
+#ifndef __PCOUNT_H__
+#define __PCOUNT_H__
+
+#include "csapp.h"
+
+#define PCOUNT_LINE 64  /* Cache line size */
+
+/*
+ * A per-thread accumulator. Each thread adds into its own slot, and
+ * every slot occupies a full cache line, so threads never write to a
+ * line another thread is using (no false sharing, unlike the adjacent
+ * psum[] elements of psum-array.c). Reading the total combines all
+ * slots and may run concurrently with updates.
+ */
+typedef struct {
+    long val;
+} __attribute__((aligned(PCOUNT_LINE))) pcount_slot_t;
+
+typedef struct {
+    int nslots;            /* One per thread id */
+    pcount_slot_t *slots;  /* Cache-line aligned array of slots */
+} pcount_t;
+
+void pcount_init(pcount_t *cp, int nslots);
+void pcount_deinit(pcount_t *cp);
+long pcount_read(pcount_t *cp);
+void pcount_reset(pcount_t *cp);
+
+/* Add v to the slot of thread id; only thread id may write that slot */
+static inline void pcount_add(pcount_t *cp, int id, long v)
+{
+    long *p = &cp->slots[id].val;
+    __atomic_store_n(p, __atomic_load_n(p, __ATOMIC_RELAXED) + v,
+		     __ATOMIC_RELAXED);
+}
+
+#endif /* __PCOUNT_H__ */
@@ -0,0 +1,138 @@
+/*
+ * psum-bench.c - Compare ways of accumulating a parallel sum
+ *
+ * Sums 0..2^log_nelems-1 with nthreads = 1, 2, 4, ... maxthreads and
+ * reports cycles per element for each accumulation strategy:
+ *   mutex   - every element locks a global sum (psum-mutex.c)
+ *   atomic  - every element does an atomic add on a global sum
+ *   array   - every element updates psum[myid], adjacent longs that
+ *             share cache lines (psum-array.c)
+ *   padded  - every element updates its own cache line (pcount_t)
+ *   local   - sum in a register, store once at the end (psum-local.c)
+ *
+ * Timing uses the cycle counter from clock.c, the one mdriver -L reads
+ * (rdtsc on x86 and x86-64; elsewhere clock.c exits with a message).
+ *
+ * Example:
+ *   linux> C=../../6_MallocLab/malloclab-explicit
+ *   linux> gcc -O2 -I../include -I$C -o psum-bench psum-bench.c pcount.c $C/clock.c ../src/csapp.c -lpthread
+ *   linux> ./psum-bench 8 24
+ */
+#include "csapp.h"
+#include "clock.h"
+#include "pcount.h"
+#define MAXTHREADS 32
+
+enum { MUTEX, ATOMIC, ARRAY, PADDED, LOCAL, NKINDS };
+static const char *kind_name[] = {"mutex", "atomic", "array", "padded", "local"};
+
+void *sum_thread(void *vargp);
+
+/* Global shared variables */
+static int kind;                       /* Strategy under test */
+static long nelems_per_thread;
+static long gsum;                      /* mutex and atomic */
+static sem_t mutex;
+static volatile long psum[MAXTHREADS]; /* array and local */
+static pcount_t pcount;                /* padded */
+
+int main(int argc, char **argv)
+{
+    long i, nthreads, maxthreads, log_nelems, nelems, myid[MAXTHREADS], result;
+    pthread_t tid[MAXTHREADS];
+    double cycles;
+
+    if (argc != 3) {
+	printf("Usage: %s <maxthreads> <log_nelems>\n", argv[0]);
+	exit(0);
+    }
+    maxthreads = atoi(argv[1]);
+    log_nelems = atoi(argv[2]);
+    nelems = (1L << log_nelems);
+    if (maxthreads < 1 || maxthreads > MAXTHREADS || log_nelems > 31) {
+	printf("Error: invalid arguments\n");
+	exit(0);
+    }
+
+    Sem_init(&mutex, 0, 1);
+    pcount_init(&pcount, MAXTHREADS);
+
+    printf("%8s", "threads");
+    for (kind = 0; kind < NKINDS; kind++)
+	printf("%10s", kind_name[kind]);
+    printf("   (cycles/element)\n");
+
+    for (nthreads = 1; nthreads <= maxthreads; nthreads *= 2) {
+	nelems_per_thread = nelems / nthreads;
+	printf("%8ld", nthreads);
+	for (kind = 0; kind < NKINDS; kind++) {
+	    gsum = 0;
+	    for (i = 0; i < MAXTHREADS; i++)
+		psum[i] = 0;
+	    pcount_reset(&pcount);
+
+	    start_counter();
+	    for (i = 0; i < nthreads; i++) {
+		myid[i] = i;
+		Pthread_create(&tid[i], NULL, sum_thread, &myid[i]);
+	    }
+	    for (i = 0; i < nthreads; i++)
+		Pthread_join(tid[i], NULL);
+	    cycles = get_counter();
+
+	    /* Combine and check */
+	    if (kind == MUTEX || kind == ATOMIC)
+		result = gsum;
+	    else if (kind == PADDED)
+		result = pcount_read(&pcount);
+	    else
+		for (i = 0, result = 0; i < nthreads; i++)
+		    result += psum[i];
+	    if (result != (nelems * (nelems-1))/2)
+		printf("\nError: %s result=%ld\n", kind_name[kind], result);
+
+	    printf("%10.2f", cycles / nelems);
+	    fflush(stdout);
+	}
+	printf("\n");
+    }
+    pcount_deinit(&pcount);
+    exit(0);
+}
+
+/* Thread routine: sum this thread's chunk using the current strategy */
+void *sum_thread(void *vargp)
+{
+    long myid = *((long *)vargp);
+    long start = myid * nelems_per_thread;
+    long end = start + nelems_per_thread;
+    long i, sum = 0;
+
+    switch (kind) {
+    case MUTEX:
+	for (i = start; i < end; i++) {
+	    P(&mutex);
+	    gsum += i;
+	    V(&mutex);
+	}
+	break;
+    case ATOMIC:
+	for (i = start; i < end; i++)
+	    __atomic_fetch_add(&gsum, i, __ATOMIC_RELAXED);
+	break;
+    case ARRAY:
+	for (i = start; i < end; i++)
+	    psum[myid] += i;
+	break;
+    case PADDED:
+	for (i = start; i < end; i++)
+	    pcount_add(&pcount, myid, i);
+	break;
+    case LOCAL:
+	for (i = start; i < end; i++)
+	    sum += i;
+	psum[myid] = sum;
+	break;
+    }
+    return NULL;
+}
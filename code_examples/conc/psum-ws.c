@@ -0,0 +1,199 @@
+/*
+ * psum-ws.c - The parallel sum programs ported to the work-stealing pool
+ *
+ * Sums 0..nelems-1 for any nelems (no divisibility requirement) with
+ * each accumulation strategy of the textbook programs:
+ *   mutex  - every element locks a global sum (psum-mutex.c)
+ *   array  - every element updates its thread's slot of psum[]
+ *            (psum-array.c); on the pool, the slot of ws_worker()
+ *   local  - sum in a local variable, store once (psum-local.c); on
+ *            the pool, ws_parallel_reduce
+ * and runs each one twice: with the static equal split of the textbook
+ * programs, and on the pool. With skew > 0 the cost of element i grows
+ * linearly with i (element i spins for skew*i/nelems extra iterations),
+ * so the thread that owns the last static chunk does most of the work
+ * while the others sit idle; work stealing rebalances it.
+ *
+ * psum-mutex.c, psum-array.c and psum-local.c themselves stay as they
+ * are: they are the listings of the book, and psum-bench.c measures them
+ * as baselines.
+ *
+ * Example:
+ *   linux> gcc -O2 -I../include -o psum-ws psum-ws.c wspool.c ../src/csapp.c -lpthread
+ *   linux> ./psum-ws 4 10000000 200
+ */
+#include <sys/time.h>
+#include "csapp.h"
+#include "wspool.h"
+#define MAXTHREADS 32
+
+enum { MUTEX, ARRAY, LOCAL, NKINDS };
+static const char *kind_name[] = {"mutex", "array", "local"};
+
+void *sum_static(void *vargp);
+void sum_mutex(long lo, long hi, void *arg);
+void sum_array(long lo, long hi, void *arg);
+long sum_range(long lo, long hi, void *arg);
+long add(long x, long y);
+
+/* Global shared variables */
+int kind;               /* Strategy under test */
+long gsum;              /* mutex */
+sem_t mutex;            /* Protects gsum */
+long psum[MAXTHREADS];  /* array and static local */
+long nelems, nthreads, skew;
+
+static double now(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/* elem - Element i, after burning skew*i/nelems extra iterations */
+static long elem(long i)
+{
+    volatile long j;
+
+    for (j = 0; j < skew * i / nelems; j++)
+	;
+    return i;
+}
+
+/* collect - Add up the partial results of the strategy under test */
+static long collect(void)
+{
+    long i, result = 0;
+
+    if (kind == MUTEX)
+	return gsum;
+    for (i = 0; i < nthreads; i++)
+	result += psum[i];
+    return result;
+}
+
+int main(int argc, char **argv)
+{
+    long i, myid[MAXTHREADS], result, expect;
+    pthread_t tid[MAXTHREADS];
+    ws_pool_t pool;
+    double start, t_static, t_ws;
+
+    /* Get input arguments */
+    if (argc != 3 && argc != 4) {
+	printf("Usage: %s <nthreads> <nelems> [skew]\n", argv[0]);
+	exit(0);
+    }
+    nthreads = atoi(argv[1]);
+    nelems = atol(argv[2]);
+    skew = (argc == 4) ? atol(argv[3]) : 0;
+    if (nthreads < 1 || nthreads > MAXTHREADS || nelems < 0 || skew < 0) {
+	printf("Error: invalid arguments\n");
+	exit(0);
+    }
+    expect = (nelems * (nelems-1))/2;
+    Sem_init(&mutex, 0, 1);
+    ws_init(&pool, nthreads);
+
+    printf("nthreads=%ld nelems=%ld skew=%ld\n", nthreads, nelems, skew);
+    for (kind = 0; kind < NKINDS; kind++) {
+	/* Static split, remainder spread over the first threads */
+	gsum = 0;
+	memset(psum, 0, sizeof(psum));
+	start = now();
+	for (i = 0; i < nthreads; i++) {
+	    myid[i] = i;
+	    Pthread_create(&tid[i], NULL, sum_static, &myid[i]);
+	}
+	for (i = 0; i < nthreads; i++)
+	    Pthread_join(tid[i], NULL);
+	result = collect();
+	t_static = now() - start;
+	if (result != expect)
+	    printf("Error: static %s result=%ld\n", kind_name[kind], result);
+
+	/* Work stealing */
+	gsum = 0;
+	memset(psum, 0, sizeof(psum));
+	start = now();
+	if (kind == MUTEX)
+	    ws_parallel_for(&pool, 0, nelems, 1024, sum_mutex, NULL);
+	else if (kind == ARRAY)
+	    ws_parallel_for(&pool, 0, nelems, 1024, sum_array, NULL);
+	result = (kind == LOCAL) ?
+	    ws_parallel_reduce(&pool, 0, nelems, 1024, sum_range, add, 0, NULL) :
+	    collect();
+	t_ws = now() - start;
+	if (result != expect)
+	    printf("Error: work-stealing %s result=%ld\n", kind_name[kind], result);
+
+	printf("%-6s static %.3fs, work-stealing %.3fs (%.2fx)\n",
+	       kind_name[kind], t_static, t_ws, t_static / t_ws);
+    }
+    ws_deinit(&pool);
+    exit(0);
+}
+
+/* Loop bodies for the pool */
+void sum_mutex(long lo, long hi, void *arg)
+{
+    long i, v;
+
+    (void)arg;
+    for (i = lo; i < hi; i++) {
+	v = elem(i);
+	P(&mutex);
+	gsum += v;
+	V(&mutex);
+    }
+}
+
+void sum_array(long lo, long hi, void *arg)
+{
+    long i, me = ws_worker();
+
+    (void)arg;
+    for (i = lo; i < hi; i++)
+	psum[me] += elem(i);
+}
+
+long sum_range(long lo, long hi, void *arg)
+{
+    long i, sum = 0;
+
+    (void)arg;
+    for (i = lo; i < hi; i++)
+	sum += elem(i);
+    return sum;
+}
+
+long add(long x, long y)
+{
+    return x + y;
+}
+
+/* Thread routine: one static chunk, accumulated as the textbook programs do */
+void *sum_static(void *vargp)
+{
+    long myid = *((long *)vargp);
+    long base = nelems / nthreads, rem = nelems % nthreads;
+    long start = myid * base + (myid < rem ? myid : rem);
+    long end = start + base + (myid < rem);
+    long i, v;
+
+    if (kind == LOCAL) {
+	psum[myid] = sum_range(start, end, NULL);
+	return NULL;
+    }
+    for (i = start; i < end; i++) {
+	v = elem(i);
+	if (kind == MUTEX) {
+	    P(&mutex);
+	    gsum += v;
+	    V(&mutex);
+	} else {
+	    psum[myid] += v;
+	}
+    }
+    return NULL;
+}
@@ -0,0 +1,147 @@
+/*
+ * sbufbench.c - Contention benchmark for sbuf.c versus lfsbuf.c
+ *
+ * For p = 1, 2, 4, ... up to <maxthreads>, runs p producer threads and
+ * p consumer threads that push 2^<log_nitems> items in total through a
+ * <slots>-slot shared buffer, and reports millions of items per second
+ * for the semaphore-based sbuf, the lock-free lfsbuf, and lfsbuf with
+ * batched insert/remove. Every consumer checks the sum of what it
+ * received so that lost or duplicated items are detected.
+ *
+ * Example:
+ *   linux> gcc -O2 -I../include -o sbufbench sbufbench.c sbuf.c lfsbuf.c ../src/csapp.c -lpthread
+ *   linux> ./sbufbench 8 22
+ */
+#include <sys/time.h>
+#include "csapp.h"
+#include "sbuf.h"
+#include "lfsbuf.h"
+
+#define MAXTHREADS 64
+#define SLOTS      1024
+#define BATCH      32
+
+enum { SEM, LOCKFREE, BATCHED };
+static const char *kind_name[] = {"sbuf", "lfsbuf", "lfsbuf-batch"};
+
+static int kind;            /* Which buffer is under test */
+static sbuf_t sbuf;
+static lfsbuf_t lfsbuf;
+static long items_per_thread;
+static long consumed_sum[MAXTHREADS];
+
+void *producer(void *vargp);
+void *consumer(void *vargp);
+
+static double now(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+int main(int argc, char **argv)
+{
+    long i, p, nitems, maxthreads, log_nitems, expect, got;
+    long myid[MAXTHREADS];
+    pthread_t ptid[MAXTHREADS], ctid[MAXTHREADS];
+    double start, secs;
+
+    if (argc != 3) {
+	printf("Usage: %s <maxthreads> <log_nitems>\n", argv[0]);
+	exit(0);
+    }
+    maxthreads = atoi(argv[1]);
+    log_nitems = atoi(argv[2]);
+    if (maxthreads < 1 || maxthreads > MAXTHREADS || log_nitems > 30) {
+	printf("Error: invalid arguments\n");
+	exit(0);
+    }
+    nitems = 1L << log_nitems;
+
+    printf("%8s %14s %12s\n", "threads", "buffer", "Mitems/s");
+    for (p = 1; p <= maxthreads; p *= 2) {
+	items_per_thread = nitems / p;
+	for (kind = SEM; kind <= BATCHED; kind++) {
+	    if (kind == SEM)
+		sbuf_init(&sbuf, SLOTS);
+	    else
+		lfsbuf_init(&lfsbuf, SLOTS);
+
+	    start = now();
+	    for (i = 0; i < p; i++) {
+		myid[i] = i;
+		Pthread_create(&ctid[i], NULL, consumer, &myid[i]);
+		Pthread_create(&ptid[i], NULL, producer, &myid[i]);
+	    }
+	    for (i = 0; i < p; i++) {
+		Pthread_join(ptid[i], NULL);
+		Pthread_join(ctid[i], NULL);
+	    }
+	    secs = now() - start;
+
+	    /* Each producer sends 0..items_per_thread-1 */
+	    expect = p * (items_per_thread * (items_per_thread - 1) / 2);
+	    for (got = 0, i = 0; i < p; i++)
+		got += consumed_sum[i];
+	    if (got != expect)
+		printf("Error: %s lost items (sum %ld, expected %ld)\n",
+		       kind_name[kind], got, expect);
+
+	    printf("%4ld+%-3ld %14s %12.2f\n", p, p, kind_name[kind],
+		   p * items_per_thread / secs / 1e6);
+
+	    if (kind == SEM)
+		sbuf_deinit(&sbuf);
+	    else
+		lfsbuf_deinit(&lfsbuf);
+	}
+    }
+    exit(0);
+}
+
+/* Thread routine: insert 0..items_per_thread-1 */
+void *producer(void *vargp)
+{
+    long i, j;
+    int batch[BATCH];
+
+    (void)vargp;
+    if (kind == BATCHED) {
+	for (i = 0; i < items_per_thread; i += j) {
+	    for (j = 0; j < BATCH && i + j < items_per_thread; j++)
+		batch[j] = (int)(i + j);
+	    lfsbuf_insert_batch(&lfsbuf, batch, (int)j);
+	}
+	return NULL;
+    }
+    for (i = 0; i < items_per_thread; i++) {
+	if (kind == SEM)
+	    sbuf_insert(&sbuf, (int)i);
+	else
+	    lfsbuf_insert(&lfsbuf, (int)i);
+    }
+    return NULL;
+}
+
+/* Thread routine: remove items_per_thread items and sum them */
+void *consumer(void *vargp)
+{
+    long myid = *((long *)vargp);
+    long i, sum = 0;
+    int j, n, batch[BATCH];
+
+    if (kind == BATCHED) {
+	for (i = 0; i < items_per_thread; i += n) {
+	    n = items_per_thread - i < BATCH ? (int)(items_per_thread - i) : BATCH;
+	    n = lfsbuf_remove_batch(&lfsbuf, batch, n);
+	    for (j = 0; j < n; j++)
+		sum += batch[j];
+	}
+    } else {
+	for (i = 0; i < items_per_thread; i++)
+	    sum += (kind == SEM) ? sbuf_remove(&sbuf) : lfsbuf_remove(&lfsbuf);
+    }
+    consumed_sum[myid] = sum;
+    return NULL;
+}
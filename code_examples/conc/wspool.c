@@ -0,0 +1,345 @@
+/*
+ * wspool.c - A work-stealing thread pool with parallel for and reduce
+ *
+ * Worker 0 is whichever thread calls ws_parallel_for/reduce; workers
+ * 1..nworkers-1 are created by ws_init. While an operation is active,
+ * every worker repeatedly pops from its own deque and, when that is
+ * empty, steals from a random victim. The caller does the same until
+ * all tasks of its operation have finished, so it never just blocks.
+ *
+ * Deque operations follow Chase and Lev, "Dynamic Circular Work-Stealing
+ * Deque" (SPAA 2005), with the C11 memory orderings of Le et al. (PPoPP
+ * 2013). The deque does not grow: if it is full, the owner simply runs
+ * the task itself instead of splitting further.
+ */
+#include "csapp.h"
+#include "wspool.h"
+
+#define LOAD(p, mo)      __atomic_load_n((p), (mo))
+#define STORE(p, v, mo)  __atomic_store_n((p), (v), (mo))
+#define SPLIT_DEPTH      2   /* Split while own deque holds fewer tasks */
+#define IDLE_SPINS       64  /* Failed steal rounds before yielding */
+
+typedef struct {           /* One parallel_for or parallel_reduce call */
+    ws_for_fn body;
+    ws_reduce_fn rbody;    /* Non-NULL for a reduction */
+    ws_combine_fn combine;
+    void *arg;
+    long mingrain;
+    long pending;          /* Tasks spawned but not yet finished */
+    struct {
+	long val;
+    } __attribute__((aligned(WS_LINE))) *partial; /* Per-worker result */
+} ws_job_t;
+
+struct ws_task {           /* A subrange of a job */
+    ws_job_t *job;
+    long lo, hi;
+};
+
+static __thread int ws_self = -1;        /* This thread's worker id */
+static __thread unsigned int ws_seed;    /* For picking steal victims */
+
+/**********************
+ * Chase-Lev deque
+ **********************/
+
+/* push - Owner only. Returns 0 if the deque is full */
+static int push(ws_deque_t *q, ws_task_t *t)
+{
+    long b = LOAD(&q->bottom, __ATOMIC_RELAXED);
+    long top = LOAD(&q->top, __ATOMIC_ACQUIRE);
+
+    if (b - top >= WS_DEQUE_SZ)
+	return 0;
+    STORE(&q->buf[b & (WS_DEQUE_SZ - 1)], t, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    STORE(&q->bottom, b + 1, __ATOMIC_RELAXED);
+    return 1;
+}
+
+/* pop - Owner only. Takes the most recently pushed task, or NULL */
+static ws_task_t *pop(ws_deque_t *q)
+{
+    long b = LOAD(&q->bottom, __ATOMIC_RELAXED) - 1;
+    long top;
+    ws_task_t *t = NULL;
+
+    STORE(&q->bottom, b, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    top = LOAD(&q->top, __ATOMIC_RELAXED);
+
+    if (top <= b) {
+	t = LOAD(&q->buf[b & (WS_DEQUE_SZ - 1)], __ATOMIC_RELAXED);
+	if (top == b) {  /* Last task: race against thieves for it */
+	    if (!__atomic_compare_exchange_n(&q->top, &top, top + 1, 0,
+					     __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+		t = NULL;
+	    STORE(&q->bottom, b + 1, __ATOMIC_RELAXED);
+	}
+    } else {
+	STORE(&q->bottom, b + 1, __ATOMIC_RELAXED);
+    }
+    return t;
+}
+
+/* steal - Any thread. Takes the oldest task, or NULL if empty or lost a race */
+static ws_task_t *steal(ws_deque_t *q)
+{
+    long top = LOAD(&q->top, __ATOMIC_ACQUIRE);
+    long b;
+    ws_task_t *t;
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    b = LOAD(&q->bottom, __ATOMIC_ACQUIRE);
+    if (top >= b)
+	return NULL;
+    t = LOAD(&q->buf[top & (WS_DEQUE_SZ - 1)], __ATOMIC_RELAXED);
+    if (!__atomic_compare_exchange_n(&q->top, &top, top + 1, 0,
+				     __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+	return NULL;
+    return t;
+}
+
+static long deque_size(ws_deque_t *q)
+{
+    return LOAD(&q->bottom, __ATOMIC_RELAXED) - LOAD(&q->top, __ATOMIC_RELAXED);
+}
+
+/**********************
+ * Task execution
+ **********************/
+
+/*
+ * run_task - Run a subrange, first splitting off right halves for
+ *     thieves as long as our own deque is close to empty and the range
+ *     is above the minimum grain. When nobody steals, the deque stays
+ *     full and the range is run in a few large chunks.
+ */
+static void run_task(ws_pool_t *pool, ws_task_t *t)
+{
+    ws_job_t *job = t->job;
+    ws_deque_t *q = &pool->deques[ws_self];
+    long lo = t->lo, hi = t->hi, mid;
+    ws_task_t *right;
+
+    while (hi - lo > job->mingrain && deque_size(q) < SPLIT_DEPTH) {
+	mid = lo + (hi - lo) / 2;
+	right = Malloc(sizeof(ws_task_t));
+	right->job = job;
+	right->lo = mid;
+	right->hi = hi;
+	__atomic_add_fetch(&job->pending, 1, __ATOMIC_RELAXED);
+	if (!push(q, right)) {
+	    __atomic_sub_fetch(&job->pending, 1, __ATOMIC_RELAXED);
+	    Free(right);
+	    break;
+	}
+	hi = mid;
+    }
+
+    /*
+     * rbody may run a nested operation, and while it waits this worker
+     * can run more of the same job and add to partial[ws_self]; so read
+     * the partial only after rbody returns.
+     */
+    if (job->rbody) {
+	long v = job->rbody(lo, hi, job->arg);
+	job->partial[ws_self].val = job->combine(job->partial[ws_self].val, v);
+    } else
+	job->body(lo, hi, job->arg);
+
+    Free(t);
+    __atomic_sub_fetch(&job->pending, 1, __ATOMIC_RELEASE);
+}
+
+/* find_task - Pop our own work, else try every other deque once */
+static ws_task_t *find_task(ws_pool_t *pool)
+{
+    int i, victim, n = pool->nworkers;
+    ws_task_t *t;
+
+    if ((t = pop(&pool->deques[ws_self])) != NULL)
+	return t;
+    victim = rand_r(&ws_seed) % n;
+    for (i = 0; i < n; i++, victim = (victim + 1) % n) {
+	if (victim == ws_self)
+	    continue;
+	if ((t = steal(&pool->deques[victim])) != NULL)
+	    return t;
+    }
+    return NULL;
+}
+
+/* Thread routine for workers 1..nworkers-1 */
+static void *worker(void *vargp)
+{
+    ws_pool_t *pool = ((void **)vargp)[0];
+    ws_task_t *t;
+    int idle = 0;
+
+    ws_self = (int)(long)((void **)vargp)[1];
+    ws_seed = ws_self * 2654435761u;
+    Free(vargp);
+
+    while (1) {
+	if ((t = find_task(pool)) != NULL) {
+	    run_task(pool, t);
+	    idle = 0;
+	    continue;
+	}
+	if (++idle < IDLE_SPINS)
+	    continue;
+	idle = 0;
+
+	/* Nothing to steal: sleep unless an operation is in progress */
+	pthread_mutex_lock(&pool->lock);
+	while (!pool->active && !pool->shutdown)
+	    pthread_cond_wait(&pool->wakeup, &pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+	if (pool->shutdown)
+	    return NULL;
+	sched_yield();
+    }
+}
+
+/**********************
+ * Public interface
+ **********************/
+
+/* Create a pool of nworkers workers, counting the calling thread */
+void ws_init(ws_pool_t *pool, int nworkers)
+{
+    int i;
+    void **args;
+
+    if (nworkers < 1)
+	nworkers = 1;
+    pool->nworkers = nworkers;
+    pool->deques = Calloc(nworkers, sizeof(ws_deque_t));
+    pool->tid = Calloc(nworkers, sizeof(pthread_t));
+    pool->active = 0;
+    pool->shutdown = 0;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->wakeup, NULL);
+
+    for (i = 1; i < nworkers; i++) {
+	args = Malloc(2 * sizeof(void *));
+	args[0] = pool;
+	args[1] = (void *)(long)i;
+	Pthread_create(&pool->tid[i], NULL, worker, args);
+    }
+}
+
+/* Stop and join the workers */
+void ws_deinit(ws_pool_t *pool)
+{
+    int i;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = 1;
+    pthread_cond_broadcast(&pool->wakeup);
+    pthread_mutex_unlock(&pool->lock);
+    for (i = 1; i < pool->nworkers; i++)
+	Pthread_join(pool->tid[i], NULL);
+    Free(pool->deques);
+    Free(pool->tid);
+}
+
+/* run_job - Seed the job with its whole range and help until it is done */
+static void run_job(ws_pool_t *pool, ws_job_t *job, long lo, long hi)
+{
+    ws_task_t *t;
+
+    if (ws_self < 0) {  /* First call from an outside thread: be worker 0 */
+	ws_self = 0;
+	ws_seed = 1;
+    }
+    if (job->mingrain < 1)
+	job->mingrain = 1;
+    job->pending = 1;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->active++;
+    pthread_cond_broadcast(&pool->wakeup);
+    pthread_mutex_unlock(&pool->lock);
+
+    t = Malloc(sizeof(ws_task_t));
+    t->job = job;
+    t->lo = lo;
+    t->hi = hi;
+    run_task(pool, t);
+
+    while (LOAD(&job->pending, __ATOMIC_ACQUIRE) > 0) {
+	if ((t = find_task(pool)) != NULL)
+	    run_task(pool, t);
+	else
+	    sched_yield();
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->active--;
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/*
+ * ws_parallel_for - Call body(lo', hi', arg) on disjoint subranges that
+ *     exactly cover [lo, hi). No subrange is split below mingrain
+ *     elements. Returns when all of them have finished.
+ */
+void ws_parallel_for(ws_pool_t *pool, long lo, long hi, long mingrain,
+                     ws_for_fn body, void *arg)
+{
+    ws_job_t job;
+
+    if (hi <= lo)
+	return;
+    memset(&job, 0, sizeof(job));
+    job.body = body;
+    job.arg = arg;
+    job.mingrain = mingrain;
+    run_job(pool, &job, lo, hi);
+}
+
+/*
+ * ws_parallel_reduce - Like ws_parallel_for, but each body call returns
+ *     a value and the values are folded with combine, which must be
+ *     associative and commutative with the given identity.
+ */
+long ws_parallel_reduce(ws_pool_t *pool, long lo, long hi, long mingrain,
+                        ws_reduce_fn body, ws_combine_fn combine,
+                        long identity, void *arg)
+{
+    ws_job_t job;
+    long result = identity;
+    int i;
+
+    if (hi <= lo)
+	return identity;
+    memset(&job, 0, sizeof(job));
+    job.rbody = body;
+    job.combine = combine;
+    job.arg = arg;
+    job.mingrain = mingrain;
+    if (posix_memalign((void **)&job.partial, WS_LINE,
+		       pool->nworkers * sizeof(*job.partial)) != 0)
+	unix_error("posix_memalign error");
+    for (i = 0; i < pool->nworkers; i++)
+	job.partial[i].val = identity;
+
+    run_job(pool, &job, lo, hi);
+
+    for (i = 0; i < pool->nworkers; i++)
+	result = combine(result, job.partial[i].val);
+    free(job.partial);
+    return result;
+}
+
+/*
+ * ws_worker - Index of the calling worker, 0..nworkers-1, for loop
+ *     bodies that keep per-worker state; -1 outside the pool.
+ */
+int ws_worker(void)
+{
+    return ws_self;
+}
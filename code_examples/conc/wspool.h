@@ -0,0 +1,52 @@
+#ifndef __WSPOOL_H__
+#define __WSPOOL_H__
+
+#include "csapp.h"
+
+#define WS_LINE     64    /* Cache line size */
+#define WS_DEQUE_SZ 4096  /* Tasks per worker deque (power of two) */
+
+/*
+ * A work-stealing thread pool. Each worker owns a Chase-Lev deque: it
+ * pushes and pops tasks at the bottom without locking, and idle workers
+ * steal from the top of a random victim's deque with a single CAS.
+ * Parallel loops are split lazily: a range is halved only while the
+ * running worker's deque is nearly empty, so the grain size adapts to
+ * how much work is actually being stolen.
+ *
+ * Parallel operations may be nested inside loop bodies, but only one
+ * thread outside the pool may start them, and a process uses one pool.
+ */
+typedef struct ws_task ws_task_t;
+
+typedef struct {
+    long top    __attribute__((aligned(WS_LINE)));  /* Thieves take from here */
+    long bottom __attribute__((aligned(WS_LINE)));  /* Owner pushes/pops here */
+    ws_task_t *buf[WS_DEQUE_SZ];
+} ws_deque_t;
+
+typedef struct {
+    int nworkers;          /* Including the thread that calls ws_parallel_* */
+    pthread_t *tid;
+    ws_deque_t *deques;    /* One per worker */
+    volatile int active;   /* Number of parallel operations in progress */
+    volatile int shutdown;
+    pthread_mutex_t lock;  /* Protects sleeping on idle */
+    pthread_cond_t wakeup;
+} ws_pool_t;
+
+/* Loop body over [lo, hi) and its reducing counterpart */
+typedef void (*ws_for_fn)(long lo, long hi, void *arg);
+typedef long (*ws_reduce_fn)(long lo, long hi, void *arg);
+typedef long (*ws_combine_fn)(long x, long y);
+
+void ws_init(ws_pool_t *pool, int nworkers);
+void ws_deinit(ws_pool_t *pool);
+void ws_parallel_for(ws_pool_t *pool, long lo, long hi, long mingrain,
+                     ws_for_fn body, void *arg);
+long ws_parallel_reduce(ws_pool_t *pool, long lo, long hi, long mingrain,
+                        ws_reduce_fn body, ws_combine_fn combine,
+                        long identity, void *arg);
+int ws_worker(void);
+
+#endif /* __WSPOOL_H__ */
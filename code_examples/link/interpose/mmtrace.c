@@ -0,0 +1,350 @@
+/*
+ * mmtrace.c - Record a program's malloc/realloc/free calls as a malloc
+ *             lab trace (.rep) file for mdriver.
+ *
+ * Builds on the run-time interposer in mymalloc.c: the wrappers call the
+ * C library's functions through dlsym(RTLD_NEXT, ...) and log each call.
+ *
+ *   linux> gcc -Wall -O2 -shared -fpic -o mmtrace.so mmtrace.c -ldl
+ *   linux> MMTRACE=prog.rep LD_PRELOAD=./mmtrace.so ./prog
+ *   linux> ./mdriver -f prog.rep
+ *
+ * Without MMTRACE the trace goes to mmtrace.<pid>.rep. It is written when
+ * the process exits normally (not on _exit or a fatal signal).
+ *
+ * Each thread appends its calls to a buffer of its own without taking a
+ * lock; a global counter gives every call a sequence number. At exit the
+ * buffers are merged in sequence order, and each block gets a trace id
+ * when it is allocated. An address maps to the id of the block that
+ * currently lives there, so an address reused after a free gets a fresh
+ * id. Frees of memory allocated before recording started are dropped.
+ * When two threads race on the same address the order is approximate,
+ * but the trace stays valid: no id is used before its 'a' or after its
+ * 'f'. A line "t <n>" is written whenever the next call was made by a
+ * different thread (threads are numbered in the order of their first
+ * call), so mtbench -f can replay the trace on threads.
+ */
+/* $begin mmtrace */
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+typedef struct {
+    unsigned long seq;
+    char type;                 /* 'a', 'r' or 'f' */
+    int tid;                   /* Thread, numbered from 0 */
+    void *ptr;                 /* Block (the new block for 'r') */
+    void *old;                 /* Old block for 'r' */
+    size_t size;
+} event_t;
+
+typedef struct tbuf {
+    struct tbuf *next;         /* All buffers, newest first */
+    event_t *ev;
+    size_t n, cap;
+    int tid;
+} tbuf_t;
+
+static void *(*mallocp)(size_t);
+static void *(*callocp)(size_t, size_t);
+static void *(*reallocp)(void *, size_t);
+static void (*freep)(void *);
+static int (*posix_memalignp)(void **, size_t, size_t);
+static void *(*memalignp)(size_t, size_t);
+static void *(*aligned_allocp)(size_t, size_t);
+
+static tbuf_t *buffers;        /* Pushed with compare-and-swap */
+static unsigned long seq;
+static int nthreads;
+static int stopped;            /* Set once the trace is being written */
+static __thread int busy;      /* Inside the recorder: don't record */
+static __thread tbuf_t *mybuf;
+
+/* dlsym may allocate before the real functions are known */
+static char boot[4096];
+static size_t boot_used;
+
+static void init(void);
+static void record(char type, void *ptr, void *old, size_t size);
+static void write_trace(void) __attribute__((destructor));
+
+/* malloc wrapper function */
+void *malloc(size_t size)
+{
+    void *ptr;
+
+    if (!mallocp)
+        init();
+    if (!mallocp) {            /* Called from dlsym during init */
+        ptr = boot + boot_used;
+        boot_used += (size + 15) & ~(size_t)15;
+        return boot_used <= sizeof(boot) ? ptr : NULL;
+    }
+    ptr = mallocp(size);
+    record('a', ptr, NULL, size);
+    return ptr;
+}
+
+/* calloc wrapper function */
+void *calloc(size_t nmemb, size_t size)
+{
+    void *ptr;
+
+    if (!callocp)
+        init();
+    if (!callocp)              /* boot is static, so already zero */
+        return malloc(nmemb * size);
+    ptr = callocp(nmemb, size);
+    record('a', ptr, NULL, nmemb * size);
+    return ptr;
+}
+
+/* realloc wrapper function */
+void *realloc(void *old, size_t size)
+{
+    void *ptr;
+
+    if (!reallocp)
+        init();
+    if (old == NULL)
+        return malloc(size);
+    if (size == 0) {
+        free(old);
+        return NULL;
+    }
+    ptr = reallocp(old, size);
+    record('r', ptr, old, size);
+    return ptr;
+}
+
+/* free wrapper function */
+void free(void *ptr)
+{
+    if (!ptr || ((char *)ptr >= boot && (char *)ptr < boot + sizeof(boot)))
+        return;
+    if (!freep)
+        init();
+    record('f', ptr, NULL, 0);
+    freep(ptr);
+}
+
+int posix_memalign(void **memptr, size_t align, size_t size)
+{
+    int rc;
+
+    if (!posix_memalignp)
+        init();
+    if ((rc = posix_memalignp(memptr, align, size)) == 0)
+        record('a', *memptr, NULL, size);
+    return rc;
+}
+
+void *memalign(size_t align, size_t size)
+{
+    void *ptr;
+
+    if (!memalignp)
+        init();
+    ptr = memalignp(align, size);
+    record('a', ptr, NULL, size);
+    return ptr;
+}
+
+void *aligned_alloc(size_t align, size_t size)
+{
+    void *ptr;
+
+    if (!aligned_allocp)
+        init();
+    ptr = aligned_allocp(align, size);
+    record('a', ptr, NULL, size);
+    return ptr;
+}
+
+/* Look up the C library's functions */
+static void init(void)
+{
+    static __thread int initializing;
+
+    if (initializing)
+        return;
+    initializing = 1;
+    mallocp = dlsym(RTLD_NEXT, "malloc");
+    callocp = dlsym(RTLD_NEXT, "calloc");
+    reallocp = dlsym(RTLD_NEXT, "realloc");
+    freep = dlsym(RTLD_NEXT, "free");
+    posix_memalignp = dlsym(RTLD_NEXT, "posix_memalign");
+    memalignp = dlsym(RTLD_NEXT, "memalign");
+    aligned_allocp = dlsym(RTLD_NEXT, "aligned_alloc");
+    if (!mallocp || !callocp || !reallocp || !freep) {
+        fputs("mmtrace: cannot find the C library's malloc\n", stderr);
+        exit(1);
+    }
+    initializing = 0;
+}
+
+/* Append one call to this thread's buffer */
+static void record(char type, void *ptr, void *old, size_t size)
+{
+    tbuf_t *b = mybuf;
+    event_t *e;
+
+    if (ptr == NULL || busy || __atomic_load_n(&stopped, __ATOMIC_RELAXED))
+        return;
+    busy = 1;
+    if (b == NULL) {
+        if ((b = mallocp(sizeof(tbuf_t))) == NULL)
+            goto out;
+        memset(b, 0, sizeof(tbuf_t));
+        b->tid = __atomic_fetch_add(&nthreads, 1, __ATOMIC_RELAXED);
+        b->next = __atomic_load_n(&buffers, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&buffers, &b->next, b, 0,
+                                            __ATOMIC_RELEASE,
+                                            __ATOMIC_RELAXED))
+            ;
+        mybuf = b;
+    }
+    if (b->n == b->cap) {
+        size_t cap = b->cap ? 2 * b->cap : 4096;
+        event_t *ev = reallocp(b->ev, cap * sizeof(event_t));
+
+        if (ev == NULL)
+            goto out;
+        b->ev = ev;
+        b->cap = cap;
+    }
+    e = &b->ev[b->n];
+    e->seq = __atomic_fetch_add(&seq, 1, __ATOMIC_RELAXED);
+    e->type = type;
+    e->tid = b->tid;
+    e->ptr = ptr;
+    e->old = old;
+    e->size = size ? size : 1; /* mm_malloc(0) may return NULL */
+    __atomic_store_n(&b->n, b->n + 1, __ATOMIC_RELEASE);
+out:
+    busy = 0;
+}
+
+/*
+ * Address -> id map: open addressing, with NULL for an empty slot and
+ * id -1 for a deleted one.
+ */
+typedef struct {
+    void *addr;
+    long id;
+} slot_t;
+
+static slot_t *table;
+static size_t table_mask;
+
+static slot_t *lookup(void *addr)
+{
+    size_t i = ((uintptr_t)addr >> 4) * 0x9E3779B97F4A7C15ULL & table_mask;
+    slot_t *tomb = NULL;
+
+    for (;; i = (i + 1) & table_mask) {
+        if (table[i].addr == NULL)
+            return tomb ? tomb : &table[i];
+        if (table[i].addr == addr && table[i].id >= 0)
+            return &table[i];
+        if (table[i].id < 0 && tomb == NULL)
+            tomb = &table[i];
+    }
+}
+
+static int by_seq(const void *a, const void *b)
+{
+    unsigned long x = ((const event_t *)a)->seq;
+    unsigned long y = ((const event_t *)b)->seq;
+
+    return (x > y) - (x < y);
+}
+
+/* Merge the buffers and write the .rep file */
+static void write_trace(void)
+{
+    char name[64], *path;
+    tbuf_t *b;
+    event_t *ev;
+    size_t n = 0, i, *sizes, live = 0, peak = 0;
+    long ids = 0, ops = 0;
+    int tid = 0;
+    slot_t *s = NULL;
+    FILE *fp, *body;
+
+    __atomic_store_n(&stopped, 1, __ATOMIC_RELAXED);
+    busy = 1;
+
+    for (b = __atomic_load_n(&buffers, __ATOMIC_ACQUIRE); b; b = b->next)
+        n += __atomic_load_n(&b->n, __ATOMIC_ACQUIRE);
+    ev = malloc(n * sizeof(event_t) + 1);
+    sizes = malloc(n * sizeof(size_t) + 1);
+    for (table_mask = 1; table_mask < 2 * n; table_mask <<= 1)
+        ;
+    table = calloc(table_mask, sizeof(slot_t));
+    table_mask--;
+    if (!ev || !sizes || !table || !(body = tmpfile())) {
+        fputs("mmtrace: out of memory writing the trace\n", stderr);
+        return;
+    }
+    for (n = 0, b = buffers; b; b = b->next) {
+        memcpy(ev + n, b->ev, b->n * sizeof(event_t));
+        n += b->n;
+    }
+    qsort(ev, n, sizeof(event_t), by_seq);
+
+    /* The header needs the totals, so write the ops to a temporary file */
+    for (i = 0; i < n; i++) {
+        if (ev[i].type != 'a') {
+            s = lookup(ev[i].type == 'r' ? ev[i].old : ev[i].ptr);
+            if (s->addr == NULL || s->id < 0)
+                continue;      /* Not allocated while recording */
+        }
+        if (ev[i].tid != tid)
+            fprintf(body, "t %d\n", tid = ev[i].tid);
+        if (ev[i].type == 'a') {
+            s = lookup(ev[i].ptr);
+            s->addr = ev[i].ptr;
+            s->id = ids;
+            sizes[ids] = ev[i].size;
+            fprintf(body, "a %ld %lu\n", ids++, (unsigned long)ev[i].size);
+            live += ev[i].size;
+        } else if (ev[i].type == 'f') {
+            fprintf(body, "f %ld\n", s->id);
+            live -= sizes[s->id];
+            s->id = -1;
+        } else {
+            long id = s->id;
+
+            fprintf(body, "r %ld %lu\n", id, (unsigned long)ev[i].size);
+            live += ev[i].size - sizes[id];
+            sizes[id] = ev[i].size;
+            s->id = -1;
+            s = lookup(ev[i].ptr);
+            s->addr = ev[i].ptr;
+            s->id = id;
+        }
+        ops++;
+        peak = live > peak ? live : peak;
+    }
+
+    if ((path = getenv("MMTRACE")) == NULL) {
+        sprintf(name, "mmtrace.%d.rep", (int)getpid());
+        path = name;
+    }
+    if ((fp = fopen(path, "w")) == NULL) {
+        perror(path);
+        return;
+    }
+    fprintf(fp, "%lu\n%ld\n%ld\n1\n", (unsigned long)peak, ids, ops);
+    rewind(body);
+    while ((i = fread(name, 1, sizeof(name), body)) > 0)
+        fwrite(name, 1, i, fp);
+    fclose(body);
+    fclose(fp);
+}
+/* $end mmtrace */
@@ -657,6 +657,199 @@ struct hostent *Gethostbyaddr(const char *addr, int len, int type)
     return p;
 }
 
+/**********************************************************************
+ * Thread-safe replacements for non-reentrant helpers.
+ *
+ * ctime_ts.c and rand.c show the lock-and-copy way of making ctime and
+ * rand thread-safe, which serializes every caller on one mutex. These
+ * versions never lock on the common path: each thread gets its own
+ * ctime buffer and PRNG state, and getnameinfo results are kept in a
+ * shared cache whose readers are lock-free (one seqlock per entry).
+ **********************************************************************/
+
+/* $begin Ctime */
+static __thread char ctime_buf[26]; /* ctime_r needs >= 26 bytes */
+
+/* Ctime - like ctime, but the string lives in a per-thread buffer */
+char *Ctime(const time_t *timep)
+{
+    char *p;
+
+    if ((p = ctime_r(timep, ctime_buf)) == NULL)
+        unix_error("Ctime error");
+    return p;
+}
+/* $end Ctime */
+
+/* $begin Rand */
+static __thread unsigned int rand_seed; /* Per-thread rand_r state */
+static __thread int rand_seeded;
+
+/* Rand - rand_r on per-thread state, seeded per thread unless Srand'ed */
+int Rand(void)
+{
+    if (!rand_seeded) {
+        rand_seed = (unsigned int)(unsigned long)pthread_self() * 2654435761u;
+        rand_seeded = 1;
+    }
+    return rand_r(&rand_seed);
+}
+
+/* Srand - set the calling thread's seed */
+void Srand(unsigned int seed)
+{
+    rand_seed = seed;
+    rand_seeded = 1;
+}
+/* $end Rand */
+
+/* $begin getnameinfo_cached */
+#define GNI_CACHE_SIZE 64  /* Number of entries (power of two) */
+#define GNI_CACHE_TTL  60  /* Seconds before an entry is looked up again */
+
+typedef struct {
+    unsigned int seq;             /* Odd while a writer is updating */
+    int flags;                    /* Those that affect the host */
+    int family;                   /* Key: address family and address */
+    unsigned char addr[16];
+    time_t expires;
+    char host[NI_MAXHOST];
+} gni_entry_t;
+
+static gni_entry_t gni_cache[GNI_CACHE_SIZE];
+static pthread_mutex_t gni_lock = PTHREAD_MUTEX_INITIALIZER; /* Serializes writers */
+
+/*
+ * gni_key - point *addr at the address bytes of an AF_INET/AF_INET6
+ *     socket address and return their length, or 0 for anything else.
+ *     The port is left out: every accepted connection has a new one.
+ */
+static size_t gni_key(const struct sockaddr *sa, socklen_t salen,
+                      const void **addr, unsigned int *port)
+{
+    if (sa->sa_family == AF_INET && salen >= sizeof(struct sockaddr_in)) {
+        const struct sockaddr_in *sin = (const struct sockaddr_in *)sa;
+        *addr = &sin->sin_addr;
+        *port = ntohs(sin->sin_port);
+        return sizeof(sin->sin_addr);
+    }
+    if (sa->sa_family == AF_INET6 && salen >= sizeof(struct sockaddr_in6)) {
+        const struct sockaddr_in6 *sin6 = (const struct sockaddr_in6 *)sa;
+        *addr = &sin6->sin6_addr;
+        *port = ntohs(sin6->sin6_port);
+        return sizeof(sin6->sin6_addr);
+    }
+    return 0;
+}
+
+static unsigned int gni_hash(int family, const void *addr, size_t len, int flags)
+{
+    const unsigned char *p = addr;
+    unsigned int h = 2166136261u ^ (unsigned int)flags;  /* FNV-1a */
+    size_t i;
+
+    h = (h ^ (unsigned int)family) * 16777619u;
+    for (i = 0; i < len; i++)
+        h = (h ^ p[i]) * 16777619u;
+    return h & (GNI_CACHE_SIZE - 1);
+}
+
+/* gni_copy - copy a cached string out, failing like getnameinfo if too long */
+static int gni_copy(char *dst, size_t dstlen, const char *src)
+{
+    size_t n;
+
+    if (dst == NULL || dstlen == 0)
+        return 0;
+    n = strlen(src);
+    if (n + 1 > dstlen)
+        return EAI_OVERFLOW;
+    memcpy(dst, src, n);
+    dst[n] = '\0';
+    return 0;
+}
+
+/*
+ * getnameinfo_cached - getnameinfo with a shared, lock-free-to-read
+ *     cache of recent host names. Servers that look up every client on
+ *     accept hit the same few addresses over and over; on a hit this
+ *     costs a hash and a copy instead of a (possibly reverse-DNS)
+ *     getnameinfo call. Only the host is cached, keyed on the address;
+ *     pass NI_NUMERICSERV too, or the service name is looked up anew.
+ *     Returns 0 or an EAI_* code like getnameinfo.
+ */
+int getnameinfo_cached(const struct sockaddr *sa, socklen_t salen, char *host,
+                       size_t hostlen, char *serv, size_t servlen, int flags)
+{
+    gni_entry_t *e;
+    const void *addr;
+    char h[NI_MAXHOST], s[NI_MAXSERV];
+    unsigned int seq, port;
+    size_t len;
+    int rc, hit, hflags = flags & ~(NI_NUMERICSERV | NI_DGRAM);
+
+    if ((len = gni_key(sa, salen, &addr, &port)) == 0)
+        return getnameinfo(sa, salen, host, hostlen, serv, servlen, flags);
+
+    /* The port changes with every connection, so the service is never
+     * cached. A numeric one is formatted here; a service name comes from
+     * getnameinfo (the services database, not DNS). */
+    if (serv != NULL && servlen > 0) {
+        if (flags & NI_NUMERICSERV) {
+            snprintf(s, sizeof(s), "%u", port);
+            rc = gni_copy(serv, servlen, s);
+        } else {
+            rc = getnameinfo(sa, salen, NULL, 0, serv, servlen, flags);
+        }
+        if (rc != 0)
+            return rc;
+    }
+    if (host == NULL || hostlen == 0)
+        return 0;
+
+    /* Fast path: optimistic read, valid only if seq did not move */
+    e = &gni_cache[gni_hash(sa->sa_family, addr, len, hflags)];
+    seq = __atomic_load_n(&e->seq, __ATOMIC_ACQUIRE);
+    hit = !(seq & 1) && e->family == sa->sa_family && e->flags == hflags
+        && e->expires > time(NULL) && memcmp(e->addr, addr, len) == 0;
+    if (hit) {
+        memcpy(h, e->host, sizeof(h));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&e->seq, __ATOMIC_RELAXED) == seq) {
+            h[NI_MAXHOST - 1] = '\0';
+            return gni_copy(host, hostlen, h);
+        }
+    }
+
+    /* Miss: look up the host alone into a full-size buffer, then publish */
+    if ((rc = getnameinfo(sa, salen, h, sizeof(h), NULL, 0, flags)) != 0)
+        return rc;
+
+    pthread_mutex_lock(&gni_lock);
+    __atomic_store_n(&e->seq, e->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    e->flags = hflags;
+    e->family = sa->sa_family;
+    memcpy(e->addr, addr, len);
+    e->expires = time(NULL) + GNI_CACHE_TTL;
+    memcpy(e->host, h, sizeof(h));
+    __atomic_store_n(&e->seq, e->seq + 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&gni_lock);
+
+    return gni_copy(host, hostlen, h);
+}
+/* $end getnameinfo_cached */
+
+void Getnameinfo_cached(const struct sockaddr *sa, socklen_t salen, char *host,
+                        size_t hostlen, char *serv, size_t servlen, int flags)
+{
+    int rc;
+
+    if ((rc = getnameinfo_cached(sa, salen, host, hostlen, serv,
+                                 servlen, flags)) != 0)
+        gai_error(rc, "Getnameinfo_cached error");
+}
+
 /************************************************
  * Wrappers for Pthreads thread control functions
  ************************************************/